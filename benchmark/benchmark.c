@@ -82,7 +82,7 @@ int main(int argc, char *argv[])
     pid = (pid_t *) calloc(total_number_of_processes, sizeof(pid_t));
 
     // open the kernel module to use it
-    devfd = open("/dev/rcontainer", O_RDWR);
+    devfd = rcontainer_open();
     if (devfd < 0)
     {
         fprintf(stderr, "Device open failed");
@@ -0,0 +1,521 @@
+//////////////////////////////////////////////////////////////////////
+//                     University of California, Riverside
+//
+//
+//
+//                             Copyright 2021
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     Microbenchmarks of every Resource Container operation, one at a
+//     time and after a warmup. Each test reports throughput and the
+//     latency distribution of one operation, as CSV or JSON, so runs of
+//     different module versions can be compared.
+//
+//     create, delete   join and leave a fresh container
+//     lock             lock + unlock with no other task in the container
+//     lock_contended   lock + unlock by several tasks in one container,
+//                      with the timer-driven switch moving the turn
+//     mmap_first       map an object that does not exist yet (size column)
+//     mmap_repeat      map an existing object again (size column)
+//     free             free an object that is no longer mapped
+//     switch           round trip of the turn between two tasks
+//
+////////////////////////////////////////////////////////////////////////
+
+#include <rcontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#define CID_BASE 1000       // containers used by the tests, away from the ones a workload would use
+#define OBJECT_SIZE_MIN (4ULL << 10)
+#define OBJECT_SIZE_MAX (1ULL << 30)
+
+struct result
+{
+    const char *test;
+    __u64 size;
+    int count;
+    double seconds;
+    __u64 *samples;     // latency of every measured operation in ns, sorted by report()
+};
+
+static int devfd;
+static int iterations = 10000;
+static int warmup = 1000;
+static int tasks = 4;
+static __u64 max_size = OBJECT_SIZE_MAX;
+static int json;
+static int reported;
+static const char *only;
+
+static __u64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    __u64 x = *(const __u64 *)a, y = *(const __u64 *)b;
+    return (x > y) - (x < y);
+}
+
+static __u64 percentile(const struct result *r, double p)
+{
+    int i = (int)(r->count * p);
+    return r->samples[(i < r->count) ? i : r->count - 1];
+}
+
+static int selected(const char *test)
+{
+    return only == NULL || strncmp(only, test, strlen(only)) == 0;
+}
+
+/**
+ * Print one line of results, samples are sorted in place. Results of tests that were not asked for are skipped.
+ */
+static void report(struct result *r)
+{
+    double mean = 0;
+    int i;
+
+    if (r->count == 0 || !selected(r->test))
+        return;
+    qsort(r->samples, r->count, sizeof(__u64), compare_u64);
+    for (i = 0; i < r->count; i++)
+        mean += r->samples[i];
+    mean /= r->count;
+
+    if (json)
+    {
+        printf("%s\n  {\"test\": \"%s\", \"size\": %llu, \"ops\": %d, \"ops_per_sec\": %.0f, \"mean_ns\": %.0f, "
+               "\"min_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+               reported ? "," : "[", r->test, r->size, r->count, r->count / r->seconds, mean, r->samples[0],
+               percentile(r, 0.5), percentile(r, 0.99), percentile(r, 0.999), r->samples[r->count - 1]);
+    }
+    else
+    {
+        if (!reported)
+            printf("test,size,ops,ops_per_sec,mean_ns,min_ns,p50_ns,p99_ns,p999_ns,max_ns\n");
+        printf("%s,%llu,%d,%.0f,%.0f,%llu,%llu,%llu,%llu,%llu\n", r->test, r->size, r->count, r->count / r->seconds,
+               mean, r->samples[0], percentile(r, 0.5), percentile(r, 0.99), percentile(r, 0.999),
+               r->samples[r->count - 1]);
+    }
+    fflush(stdout);
+    reported++;
+}
+
+static void result_init(struct result *r, const char *test, __u64 size, int count)
+{
+    r->test = test;
+    r->size = size;
+    r->count = 0;
+    r->seconds = 0;
+    r->samples = calloc(count, sizeof(__u64));
+    if (r->samples == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+}
+
+/**
+ * Stop the benchmark when a library call fails, a number measured around a failed call means nothing.
+ */
+static void check(int ret, const char *what)
+{
+    if (ret < 0)
+    {
+        perror(what);
+        exit(1);
+    }
+}
+
+/**
+ * Wait for count forked tasks. If one of them failed, the others are killed, they may be parked for good.
+ */
+static void wait_tasks(const pid_t *pids, int count)
+{
+    int i, j, status;
+
+    for (i = 0; i < count; i++)
+    {
+        if (wait(&status) < 0)
+        {
+            perror("wait");
+            exit(1);
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            for (j = 0; j < count; j++)
+                kill(pids[j], SIGKILL);
+            fprintf(stderr, "A benchmark task failed\n");
+            exit(1);
+        }
+    }
+}
+
+static void bench_create_delete(void)
+{
+    struct result create, delete;
+    __u64 start, middle, end, total = 0;
+    int i;
+
+    result_init(&create, "create", 0, iterations);
+    result_init(&delete, "delete", 0, iterations);
+    for (i = 0; i < warmup + iterations; i++)
+    {
+        start = now_ns();
+        check(rcontainer_create(devfd, CID_BASE), "rcontainer_create");
+        middle = now_ns();
+        check(rcontainer_delete(devfd), "rcontainer_delete");
+        end = now_ns();
+        if (i < warmup)
+            continue;
+        create.samples[create.count++] = middle - start;
+        delete.samples[delete.count++] = end - middle;
+        total += end - start;
+    }
+    create.seconds = delete.seconds = total / 1e9;
+    report(&create);
+    report(&delete);
+    free(create.samples);
+    free(delete.samples);
+}
+
+static void bench_lock(void)
+{
+    struct result r;
+    __u64 start, end, begin;
+    int i;
+
+    result_init(&r, "lock", 0, iterations);
+    check(rcontainer_create(devfd, CID_BASE + 1), "rcontainer_create");
+    for (i = 0; i < warmup; i++)
+    {
+        check(rcontainer_lock(devfd, 1), "rcontainer_lock");
+        check(rcontainer_unlock(devfd, 1), "rcontainer_unlock");
+    }
+    begin = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        start = now_ns();
+        check(rcontainer_lock(devfd, 1), "rcontainer_lock");
+        check(rcontainer_unlock(devfd, 1), "rcontainer_unlock");
+        end = now_ns();
+        r.samples[r.count++] = end - start;
+    }
+    r.seconds = (now_ns() - begin) / 1e9;
+    check(rcontainer_delete(devfd), "rcontainer_delete");
+    report(&r);
+    free(r.samples);
+}
+
+/**
+ * Every task of the container runs lock + increment + unlock on one object. Only the task that has the turn
+ * runs, so the timer of rcontainer_init() makes a holder lose the turn now and then, and the others wait.
+ */
+static void bench_lock_contended(void)
+{
+    struct result r;
+    __u64 *samples, begin;
+    int *counter;
+    pid_t *pids;
+    int i, j;
+
+    samples = mmap(0, sizeof(__u64) * iterations * tasks, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    pids = calloc(tasks, sizeof(pid_t));
+    if (samples == MAP_FAILED || pids == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    begin = now_ns();
+    for (j = 0; j < tasks; j++)
+    {
+        pids[j] = fork();
+        check(pids[j], "fork");
+        if (pids[j] == 0)
+        {
+            rcontainer_init(devfd);
+            check(rcontainer_create(devfd, CID_BASE + 2), "rcontainer_create");
+            counter = (int *)rcontainer_heap_alloc(devfd, 1, sizeof(int));
+            if (counter == MAP_FAILED)
+            {
+                perror("rcontainer_heap_alloc");
+                exit(1);
+            }
+            for (i = 0; i < warmup + iterations; i++)
+            {
+                __u64 start = now_ns();
+                check(rcontainer_lock(devfd, 1), "rcontainer_lock");
+                (*counter)++;
+                check(rcontainer_unlock(devfd, 1), "rcontainer_unlock");
+                if (i >= warmup)
+                    samples[j * iterations + i - warmup] = now_ns() - start;
+            }
+            check(rcontainer_delete(devfd), "rcontainer_delete");
+            exit(0);
+        }
+    }
+    wait_tasks(pids, tasks);
+    free(pids);
+
+    result_init(&r, "lock_contended", 0, iterations * tasks);
+    r.seconds = (now_ns() - begin) / 1e9;
+    memcpy(r.samples, samples, sizeof(__u64) * iterations * tasks);
+    r.count = iterations * tasks;
+    munmap(samples, sizeof(__u64) * iterations * tasks);
+    report(&r);
+    free(r.samples);
+}
+
+/**
+ * Map objects from 4 KB up to max_size. The first mapping creates the object, the repeat maps it again.
+ * Large objects get fewer rounds, so each size moves about the same amount of memory.
+ */
+static void bench_mmap(void)
+{
+    struct result first, repeat;
+    __u64 size, start, middle, end;
+    void *data;
+    int i, rounds, extra;
+
+    check(rcontainer_create(devfd, CID_BASE + 3), "rcontainer_create");
+    for (size = OBJECT_SIZE_MIN; size <= max_size; size *= 4)
+    {
+        rounds = iterations / (size / OBJECT_SIZE_MIN);
+        if (rounds < 4)
+            rounds = 4;
+        extra = (size == OBJECT_SIZE_MIN) ? warmup : 0;
+        result_init(&first, "mmap_first", size, rounds);
+        result_init(&repeat, "mmap_repeat", size, rounds);
+        for (i = 0; i < extra + rounds; i++)
+        {
+            start = now_ns();
+            data = rcontainer_heap_alloc(devfd, 1, size);
+            middle = now_ns();
+            if (data == MAP_FAILED)
+            {
+                fprintf(stderr, "rcontainer_heap_alloc of %llu bytes failed\n", size);
+                exit(1);
+            }
+            munmap(data, size);
+            end = now_ns();
+            data = rcontainer_heap_alloc(devfd, 1, size);
+            if (data == MAP_FAILED)
+            {
+                fprintf(stderr, "rcontainer_heap_alloc of %llu bytes failed\n", size);
+                exit(1);
+            }
+            if (i >= extra)
+            {
+                first.samples[first.count++] = middle - start;
+                repeat.samples[repeat.count++] = now_ns() - end;
+                first.seconds += (middle - start) / 1e9;
+                repeat.seconds += (now_ns() - end) / 1e9;
+            }
+            munmap(data, size);
+            check(rcontainer_free(devfd, 1), "rcontainer_free");
+        }
+        report(&first);
+        report(&repeat);
+        free(first.samples);
+        free(repeat.samples);
+    }
+    check(rcontainer_delete(devfd), "rcontainer_delete");
+}
+
+static void bench_free(void)
+{
+    struct result r;
+    __u64 start, end;
+    void *data;
+    int i;
+
+    result_init(&r, "free", OBJECT_SIZE_MIN, iterations);
+    check(rcontainer_create(devfd, CID_BASE + 4), "rcontainer_create");
+    for (i = 0; i < warmup + iterations; i++)
+    {
+        data = rcontainer_heap_alloc(devfd, i + 1, OBJECT_SIZE_MIN);
+        if (data == MAP_FAILED)
+        {
+            fprintf(stderr, "rcontainer_heap_alloc failed\n");
+            exit(1);
+        }
+        munmap(data, OBJECT_SIZE_MIN);
+    }
+    for (i = 0; i < warmup + iterations; i++)
+    {
+        start = now_ns();
+        check(rcontainer_free(devfd, i + 1), "rcontainer_free");
+        end = now_ns();
+        if (i >= warmup)
+        {
+            r.samples[r.count++] = end - start;
+            r.seconds += (end - start) / 1e9;
+        }
+    }
+    check(rcontainer_delete(devfd), "rcontainer_delete");
+    report(&r);
+    free(r.samples);
+}
+
+/**
+ * Two tasks in one container hand the turn back and forth with the switch.
+ * The first task times the round trip: its switch wakes the second one, whose switch wakes it again.
+ */
+static void bench_switch(void)
+{
+    struct resource_container_stats stats;
+    struct result *r;
+    volatile int *stop;
+    __u64 start, begin = 0;
+    pid_t pids[2];
+    int i;
+
+    r = mmap(0, sizeof(*r) + sizeof(__u64) * iterations, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    stop = mmap(0, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED || stop == MAP_FAILED)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    r->samples = (__u64 *)(r + 1);
+    r->count = 0;
+
+    pids[0] = fork();
+    check(pids[0], "fork");
+    if (pids[0] == 0)
+    {
+        check(rcontainer_create(devfd, CID_BASE + 5), "rcontainer_create");
+        // the round trip needs a partner, wait for the second task to be parked in the container
+        do
+        {
+            usleep(100);
+            check(rcontainer_stats(devfd, CID_BASE + 5, &stats, NULL, 0), "rcontainer_stats");
+        } while (stats.nr_threads < 2);
+        for (i = 0; i < warmup + iterations; i++)
+        {
+            if (i == warmup)
+                begin = now_ns();
+            start = now_ns();
+            check(rcontainer_context_switch_handler(devfd, CID_BASE + 5), "rcontainer_context_switch_handler");
+            if (i >= warmup)
+                r->samples[r->count++] = now_ns() - start;
+        }
+        r->seconds = (now_ns() - begin) / 1e9;
+        *stop = 1;
+        check(rcontainer_delete(devfd), "rcontainer_delete");
+        exit(0);
+    }
+    pids[1] = fork();
+    check(pids[1], "fork");
+    if (pids[1] == 0)
+    {
+        usleep(1000);
+        check(rcontainer_create(devfd, CID_BASE + 5), "rcontainer_create");
+        while (!*stop)
+            check(rcontainer_context_switch_handler(devfd, CID_BASE + 5), "rcontainer_context_switch_handler");
+        check(rcontainer_delete(devfd), "rcontainer_delete");
+        exit(0);
+    }
+    wait_tasks(pids, 2);
+
+    r->test = "switch";
+    r->size = 0;
+    report(r);
+    munmap((void *)stop, sizeof(int));
+    munmap(r, sizeof(*r) + sizeof(__u64) * iterations);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "jn:w:p:m:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            json = 1;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'p':
+            tasks = atoi(optarg);
+            break;
+        case 'm':
+            max_size = strtoull(optarg, NULL, 0);
+            break;
+        case 't':
+            only = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j] [-n iterations] [-w warmup] [-p tasks_for_lock_contended] [-m max_object_bytes] [-t test]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (iterations < 1 || warmup < 0 || tasks < 1)
+    {
+        fprintf(stderr, "Invalid arguments\n");
+        exit(1);
+    }
+
+    // open the kernel module to use it
+    devfd = rcontainer_open();
+    if (devfd < 0)
+    {
+        fprintf(stderr, "Device open failed");
+        exit(1);
+    }
+
+    if (selected("create") || selected("delete"))
+        bench_create_delete();
+    if (selected("lock"))
+        bench_lock();
+    if (selected("lock_contended"))
+        bench_lock_contended();
+    if (selected("mmap_first") || selected("mmap_repeat"))
+        bench_mmap();
+    if (selected("free"))
+        bench_free();
+    if (selected("switch"))
+        bench_switch();
+    if (json)
+        printf("%s]\n", reported ? "\n" : "[");
+
+    close(devfd);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/bash
+
+# Scalability matrix: run the shared-counter workload of ./benchmark for every
+# combination of containers x tasks per container x heap size x cores, and print
+# one table row per cell:
+#   throughput  numbers produced per second by all tasks together
+#   mean/stddev progress of the tasks (numbers each one produced); a stddev
+#               that is large next to the mean means some tasks starved
+#   wall        wall time of the run in seconds
+#
+# The module must be loaded and /dev/rcontainer writable (see test.sh), unless
+# RCONTAINER_BACKEND=user runs everything on the user-space backend of the library.
+# The axes can be changed through the environment, e.g.
+#   CONTAINERS="1 4 16" TASKS="1 8" HEAPS="65536" CORES="1 4" ./scale.sh
+# REPEAT runs every cell that many times and reports the average.
+
+CONTAINERS=${CONTAINERS:-"1 2 4 8"}
+TASKS=${TASKS:-"1 2 4 8"}
+HEAPS=${HEAPS:-"4096 65536 1048576"}
+CORES=${CORES:-"1 2 4 $(nproc)"}
+REPEAT=${REPEAT:-1}
+
+BENCHMARK=$(realpath "$(dirname "$0")/benchmark")
+
+if [ ! -x "$BENCHMARK" ]; then
+    echo "$BENCHMARK not found, run make in $(dirname "$0") first"
+    exit 1
+fi
+if [ "$RCONTAINER_BACKEND" != "user" ] && [ ! -w /dev/rcontainer ]; then
+    echo "/dev/rcontainer is not there or not writable, load the module first"
+    exit 1
+fi
+
+# the workload writes one rcontainer.<pid>.log per task to its working directory
+WORKDIR=$(mktemp -d)
+trap 'rm -rf "$WORKDIR"' EXIT
+
+printf "%10s %6s %10s %5s %14s %12s %12s %10s\n" containers tasks heap cores throughput mean stddev wall
+
+for cores in $CORES; do
+    if [ "$cores" -gt "$(nproc)" ]; then
+        continue
+    fi
+    for containers in $CONTAINERS; do
+        for tasks in $TASKS; do
+            for heap in $HEAPS; do
+                args="$containers"
+                for ((c = 0; c < containers; c++)); do
+                    args="$args $tasks $heap"
+                done
+
+                total_wall=0
+                rm -f "$WORKDIR"/*.log
+                for ((r = 0; r < REPEAT; r++)); do
+                    start=$(date +%s%N)
+                    (cd "$WORKDIR" && taskset -c 0-$((cores - 1)) "$BENCHMARK" $args)
+                    end=$(date +%s%N)
+                    total_wall=$((total_wall + end - start))
+                done
+
+                # "Process: <pid> in container <cid> produces <n> numbers in the heap. ..."
+                cat "$WORKDIR"/*.log 2>/dev/null | awk -v wall="$total_wall" -v repeat="$REPEAT" \
+                    -v containers="$containers" -v tasks="$tasks" -v heap="$heap" -v cores="$cores" '
+                    /produces/ { n++; sum += $7; sumsq += $7 * $7 }
+                    END {
+                        mean = n ? sum / n : 0
+                        var = n ? sumsq / n - mean * mean : 0
+                        seconds = wall / 1e9
+                        printf "%10d %6d %10d %5d %14.0f %12.1f %12.1f %10.3f\n", containers, tasks, heap, cores,
+                               (seconds > 0) ? sum / seconds : 0, mean, sqrt((var > 0) ? var : 0), seconds / repeat
+                    }'
+            done
+        done
+    done
+done
@@ -42,6 +42,234 @@ struct resource_container_cmd {
     __u64 oid;
 };
 
+struct resource_container_snapshot_cmd {
+    __u64 oid;
+    __u64 snapshot_oid;
+};
+
+// Persistent objects are files on tmpfs (the module's persist_dir). They outlive a process or a module reload,
+// not a reboot or a crash.
+struct resource_container_attach_cmd {
+    __u64 oid;
+    __u64 size;     // 0 reattaches with the size of the existing file
+    __u64 flags;
+};
+
+struct resource_container_lock_cmd {
+    __u64 oid;
+    __u64 timeout_ns;   // RCONTAINER_IOCTL_TIMEDLOCK only
+    __u64 flags;        // RCONTAINER_LOCK_SHARED
+};
+
+struct resource_container_multilock_cmd {
+    __u64 oids;         // user address of an array of count oids
+    __u32 count;        // at most RCONTAINER_MULTILOCK_MAX
+    __u32 flags;        // RCONTAINER_LOCK_SHARED | RCONTAINER_LOCK_TRY
+};
+
+struct resource_container_atomic_cmd {
+    __u64 oid;
+    __u64 offset;       // byte offset in the object, aligned to size
+    __u32 op;           // RCONTAINER_ATOMIC_*
+    __u32 size;         // 4 or 8 bytes
+    __u64 value;        // addend for ADD, new value for XCHG and CMPXCHG
+    __u64 expected;     // CMPXCHG only
+    __u64 result;       // out: the value before the operation
+};
+
+struct resource_container_atomic_batch {
+    __u64 ops;          // user address of an array of count struct resource_container_atomic_cmd
+    __u32 count;        // at most RCONTAINER_ATOMIC_BATCH_MAX
+    __u32 flags;
+};
+
+struct resource_container_wait_cmd {
+    __u64 oid;
+    __u32 version;      // in: the version the caller has seen, out: the current version
+    __u32 flags;        // RCONTAINER_WAIT_NONBLOCK, RCONTAINER_WAIT_POLL
+};
+
+struct resource_container_notify_cmd {
+    __u64 oid;
+    __u32 count;        // number of waiters to wake, 0 wakes all of them
+    __u32 version;      // out: the version after the notification
+};
+
+// One command of RCONTAINER_IOCTL_BATCH
+struct resource_container_batch_entry {
+    __u32 op;           // RCONTAINER_OP_*
+    __s32 result;       // out: 0, or a negative errno; -ECANCELED when an earlier entry failed,
+                        // except unlocks of locks taken earlier in the batch, which still run
+    __u64 oid;
+    __u64 arg;          // atomics: byte offset of the word, NOTIFY: number of waiters to wake (0 for all)
+    __u64 value;        // atomics: addend or new value; out: the old value of the word
+    __u64 expected;     // CMPXCHG: the expected value
+    __u32 size;         // atomics: 4 or 8
+    __u32 flags;
+};
+
+struct resource_container_batch_cmd {
+    __u64 entries;      // user address of an array of count struct resource_container_batch_entry
+    __u32 count;        // at most RCONTAINER_BATCH_MAX
+    __u32 flags;
+};
+
+struct resource_container_migrate_cmd {
+    __s32 tid;          // task to move, 0 for the caller
+    __s32 cid;          // container to move it to, created if it does not exist
+    __u32 flags;
+    __u32 reserved;
+};
+
+// Checkpoint stream written by RCONTAINER_IOCTL_CHECKPOINT and read back by RCONTAINER_IOCTL_RESTORE:
+// a header, then for every object a record followed by extents, each extent followed by its pages.
+// An extent with nr_pages 0 ends the object. Pages in no extent are zero in a full checkpoint and
+// unchanged since the previous checkpoint in an incremental one.
+struct resource_container_checkpoint_header {
+    __u32 magic;        // RCONTAINER_CHECKPOINT_MAGIC
+    __u32 version;      // RCONTAINER_CHECKPOINT_VERSION
+    __u32 page_size;
+    __u32 flags;        // RCONTAINER_CHECKPOINT_INCREMENTAL
+    __s32 cid;
+    __u32 reserved;
+    __u64 nr_objects;
+};
+
+struct resource_container_checkpoint_object {
+    __u64 oid;
+    __u64 nr_pages;     // size of the object
+};
+
+struct resource_container_checkpoint_extent {
+    __u64 first_page;
+    __u64 nr_pages;
+};
+
+struct resource_container_checkpoint_cmd {
+    __s32 fd;           // file the stream is written to / read from, at its current offset
+    __u32 flags;        // RCONTAINER_CHECKPOINT_INCREMENTAL for a checkpoint
+    __u64 bytes;        // out: length of the stream
+};
+
+// Attributes of a container, see RCONTAINER_IOCTL_SETUP
+struct resource_container_attr {
+    __s32 cid;
+    __u32 weight;       // consecutive switch turns the container gets, 0 keeps the current value (1 for a new container),
+                        // at most RCONTAINER_WEIGHT_MAX
+    __u64 timeslice_ns; // minimum time a thread keeps the turn within its container, 0 rotates on every switch
+    __u64 quota_ns;     // CPU time budget of the container, recorded for accounting
+};
+
+struct resource_container_setup_cmd {
+    __u64 attrs;        // user address of an array of count struct resource_container_attr
+    __u32 count;        // at most RCONTAINER_SETUP_MAX
+    __u32 flags;        // RCONTAINER_SETUP_*
+};
+
+struct resource_container_task {
+    __s32 pid;          // task to register, e.g. a child that was just forked
+    __s32 cid;          // container it joins, created if it does not exist
+};
+
+struct resource_container_register_cmd {
+    __u64 tasks;        // user address of an array of count struct resource_container_task
+    __u32 count;        // at most RCONTAINER_SETUP_MAX
+    __u32 flags;
+};
+
+// Submission and completion rings of a device fd, set up with RCONTAINER_IOCTL_RING_SETUP and mapped at
+// RCONTAINER_RING_OFFSET. User space fills sqes and advances sq_tail; RCONTAINER_IOCTL_RING_ENTER runs them
+// in order, like the entries of a batch, and posts one cqe each, advancing cq_tail. Unlike a batch, a failed
+// entry does not cancel the ones after it. Entries run without the ring's lock, so when several threads enter
+// the same ring cqes come in completion order; match them by user_data. Heads and tails are free-running,
+// index with & (entries - 1).
+struct resource_container_ring_header {
+    __u32 sq_head;      // next submission the kernel takes, written by the kernel
+    __u32 sq_tail;      // next free submission, written by user space
+    __u32 cq_head;      // next completion user space reads, written by user space
+    __u32 cq_tail;      // next free completion, written by the kernel
+    __u32 entries;      // size of both rings, a power of two
+    __u32 sq_offset;    // byte offset of the sqe array in the mapping
+    __u32 cq_offset;    // byte offset of the cqe array in the mapping
+    __u32 reserved;
+};
+
+struct resource_container_ring_sqe {
+    struct resource_container_batch_entry cmd;  // result is ignored, it comes back in the cqe
+    __u64 user_data;    // copied to the cqe
+};
+
+struct resource_container_ring_cqe {
+    __u64 user_data;
+    __s32 result;       // 0 or a negative errno
+    __u32 flags;
+    __u64 value;        // the old value of the word for an atomic that succeeded, 0 otherwise
+};
+
+struct resource_container_ring_setup {
+    __u32 entries;      // in: size of each ring, a power of two up to RCONTAINER_RING_MAX_ENTRIES
+    __u32 flags;
+    __u64 size;         // out: length to mmap at RCONTAINER_RING_OFFSET
+};
+
+struct resource_container_ring_enter {
+    __u32 to_submit;    // submissions to run, 0 runs all that are queued
+    __u32 flags;
+};
+
+// One slot of the lock page. Each container has one lock page, mapped at RCONTAINER_LOCK_PAGE_OFFSET,
+// and every lock of the container gets a slot in it while there is room.
+struct resource_container_lock_slot {
+    __u32 word;         // RCONTAINER_LOCK_* bits and the shared holder count
+    __u32 seq;          // odd while held exclusively, bumped by every exclusive lock and unlock
+    __u64 oid;
+    __u64 acquisitions; // acquisitions taken in user space without the kernel, counted by the library, advisory
+    __u64 reserved;
+};
+
+struct resource_container_lock_stats {
+    __u64 oid;              // in: the object whose lock is reported
+    __u64 acquisitions;     // acquisitions taken in the kernel
+    __u64 contended;        // acquisitions that had to sleep
+    __u64 wait_ns;          // total time slept by contended acquisitions
+    __u64 wait_max_ns;      // longest of those sleeps
+    __u64 hold_ns;          // total time held exclusively, for holds taken in the kernel
+    __s32 holder;           // tid of the last task that took the lock in the kernel, 0 if none
+    __u32 reserved;
+    __u64 user_acquisitions;    // advisory: counted by the library in the writable lock page, any member can change it
+};
+
+struct resource_container_thread_stats {
+    __s32 tid;
+    __u32 reserved;
+    __u64 turns;            // times the thread got the turn in its container
+    __u64 runtime_ns;       // CPU time since the thread joined the container
+    __u64 parked_ns;        // time spent waiting for the turn
+};
+
+struct resource_container_stats {
+    __s32 cid;              // in: the container reported
+    __u32 nr_threads;
+    __u64 runtime_ns;       // CPU time of the member threads while in the container, including threads that left
+    __u64 switches;         // times the switch moved the turn to another thread of the container
+    __u64 parked_ns;        // time member threads spent waiting for the turn
+    __u64 quota_ns;
+    __u64 timeslice_ns;
+    __u32 weight;
+    __u32 count;            // in: room in threads, out: entries filled
+    __u64 threads;          // user address of an array of count struct resource_container_thread_stats, may be 0
+};
+
+// Latency histogram of one kind of operation, summed over all CPUs.
+// buckets[i] counts operations that took [2^i, 2^(i+1)) ns, buckets[0] also those under 1 ns.
+struct resource_container_latency {
+    __u32 op;               // in: RCONTAINER_LAT_*
+    __u32 flags;            // in: RCONTAINER_LATENCY_RESET clears the histogram after it is read (CAP_SYS_ADMIN)
+    __u64 count;
+    __u64 sum_ns;
+    __u64 buckets[64];      // RCONTAINER_LATENCY_BUCKETS
+};
+
 struct mapping_entry
 {
     void *page;
@@ -65,5 +293,139 @@ struct task_struct_node
 #define RCONTAINER_IOCTL_CREATE  _IOWR('N', 0x46, struct resource_container_cmd)
 #define RCONTAINER_IOCTL_CSWITCH  _IOWR('N', 0x47, struct resource_container_cmd)
 #define RCONTAINER_IOCTL_FREE _IOWR('N', 0x48, struct resource_container_cmd)
+#define RCONTAINER_IOCTL_TRANSFER _IOWR('N', 0x49, struct resource_container_cmd)
+#define RCONTAINER_IOCTL_SNAPSHOT _IOWR('N', 0x4a, struct resource_container_snapshot_cmd)
+#define RCONTAINER_IOCTL_ATTACH _IOWR('N', 0x4b, struct resource_container_attach_cmd)
+// 0x4c is not used: persistent objects live on tmpfs, there is nothing to sync
+#define RCONTAINER_IOCTL_LOCK_SLOT _IOWR('N', 0x4d, struct resource_container_cmd)
+#define RCONTAINER_IOCTL_RDLOCK _IOWR('N', 0x4e, struct resource_container_cmd)
+#define RCONTAINER_IOCTL_TRYLOCK _IOWR('N', 0x4f, struct resource_container_lock_cmd)
+#define RCONTAINER_IOCTL_TIMEDLOCK _IOWR('N', 0x50, struct resource_container_lock_cmd)
+#define RCONTAINER_IOCTL_MULTILOCK _IOWR('N', 0x51, struct resource_container_multilock_cmd)
+#define RCONTAINER_IOCTL_MULTIUNLOCK _IOWR('N', 0x52, struct resource_container_multilock_cmd)
+#define RCONTAINER_IOCTL_ATOMIC _IOWR('N', 0x53, struct resource_container_atomic_cmd)
+#define RCONTAINER_IOCTL_ATOMIC_BATCH _IOWR('N', 0x54, struct resource_container_atomic_batch)
+#define RCONTAINER_IOCTL_WAIT _IOWR('N', 0x55, struct resource_container_wait_cmd)
+#define RCONTAINER_IOCTL_NOTIFY _IOWR('N', 0x56, struct resource_container_notify_cmd)
+#define RCONTAINER_IOCTL_LOCK_STATS _IOWR('N', 0x57, struct resource_container_lock_stats)
+#define RCONTAINER_IOCTL_BATCH _IOWR('N', 0x58, struct resource_container_batch_cmd)
+#define RCONTAINER_IOCTL_RING_SETUP _IOWR('N', 0x59, struct resource_container_ring_setup)
+#define RCONTAINER_IOCTL_RING_ENTER _IOWR('N', 0x5a, struct resource_container_ring_enter)
+#define RCONTAINER_IOCTL_MIGRATE _IOWR('N', 0x5b, struct resource_container_migrate_cmd)
+#define RCONTAINER_IOCTL_SETUP _IOWR('N', 0x5c, struct resource_container_setup_cmd)
+#define RCONTAINER_IOCTL_REGISTER _IOWR('N', 0x5d, struct resource_container_register_cmd)
+#define RCONTAINER_IOCTL_SELECT _IOWR('N', 0x5e, struct resource_container_cmd)
+#define RCONTAINER_IOCTL_CHECKPOINT _IOWR('N', 0x5f, struct resource_container_checkpoint_cmd)
+#define RCONTAINER_IOCTL_RESTORE _IOWR('N', 0x60, struct resource_container_checkpoint_cmd)
+#define RCONTAINER_IOCTL_STATS _IOWR('N', 0x61, struct resource_container_stats)
+#define RCONTAINER_IOCTL_LATENCY _IOWR('N', 0x62, struct resource_container_latency)
+
+// modes of RCONTAINER_IOCTL_TRANSFER, passed in resource_container_cmd.op
+#define RCONTAINER_TRANSFER_MOVE    0
+#define RCONTAINER_TRANSFER_SHARE   1
+
+// read(), write(), their p/v variants, splice, sendfile and copy_file_range on a device fd address the data of
+// the object selected with RCONTAINER_IOCTL_SELECT (cmd.oid); file offsets are byte offsets in that object.
+
+// mmap offsets (in pages) from RCONTAINER_RESERVED_OFFSET on are not objects
+#define RCONTAINER_RESERVED_OFFSET      (1ULL << 32)
+#define RCONTAINER_LOCK_PAGE_OFFSET     RCONTAINER_RESERVED_OFFSET
+#define RCONTAINER_RING_OFFSET          (RCONTAINER_RESERVED_OFFSET + 1)
+
+#define RCONTAINER_RING_MAX_ENTRIES 4096
+
+#define RCONTAINER_SETUP_MAX        4096
+#define RCONTAINER_WEIGHT_MAX       1024    // largest weight of a container, setup fails with -EINVAL above it
+
+// flags of RCONTAINER_IOCTL_SETUP
+#define RCONTAINER_SETUP_REMOVE     1   // remove the listed containers instead, they must have no thread
+
+#define RCONTAINER_CHECKPOINT_MAGIC         0x4b435243      // "RCCK"
+#define RCONTAINER_CHECKPOINT_VERSION       1
+#define RCONTAINER_CHECKPOINT_INCREMENTAL   1   // only pages written since the previous checkpoint
+
+// operations with a latency histogram, timed around the ioctl dispatch and mmap
+#define RCONTAINER_LAT_CREATE   0
+#define RCONTAINER_LAT_DELETE   1
+#define RCONTAINER_LAT_SWITCH   2
+#define RCONTAINER_LAT_LOCK     3       // lock, rdlock, trylock, timedlock and multilock, including the wait
+#define RCONTAINER_LAT_UNLOCK   4       // unlock and multiunlock
+#define RCONTAINER_LAT_FREE     5
+#define RCONTAINER_LAT_MMAP     6
+#define RCONTAINER_LAT_OTHER    7       // every other ioctl
+#define RCONTAINER_LAT_OPS      8
+#define RCONTAINER_LATENCY_BUCKETS  64
+#define RCONTAINER_LATENCY_RESET    1   // needs CAP_SYS_ADMIN, the histograms are global
+
+// Upper bound in ns of the bucket that holds the permille-th of count operations (500 for p50, 999 for p999),
+// 0 if count is 0. Used by the module and the library alike, so both report the same percentiles.
+static inline __u64 rcontainer_latency_bucket_percentile(const __u64 *buckets, __u64 count, int permille)
+{
+    __u64 seen = 0;
+    int i;
+
+    if (count == 0)
+        return 0;
+    for (i = 0; i < RCONTAINER_LATENCY_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen != 0 && seen * 1000 >= count * permille)
+            return (i < 63) ? (2ULL << i) - 1 : ~0ULL;
+    }
+    return ~0ULL;
+}
+
+// lock word protocol: user space takes a free lock with cas(0, HELD) and releases it with cas(HELD, 0).
+// A shared lock adds one to READERS while neither HELD nor WRITER_WAITING is set, and subtracts one to release it
+// while WAITERS is clear. Anything else goes through the ioctls, which sleep and wake on behalf of the word.
+#define RCONTAINER_LOCK_HELD            0x80000000u     // held exclusively
+#define RCONTAINER_LOCK_WAITERS         0x40000000u     // a task sleeps in the kernel, the release must wake it
+#define RCONTAINER_LOCK_WRITER_WAITING  0x20000000u     // an exclusive waiter holds off new shared holders
+#define RCONTAINER_LOCK_READERS         0x1fffffffu     // number of shared holders
+#define RCONTAINER_LOCK_SLOTS       128     // 4096 / sizeof(struct resource_container_lock_slot)
+
+// Readers that only need a consistent copy of a small object can skip the lock: read slot.seq (wait while odd),
+// copy the object, and retry if slot.seq changed meanwhile.
+
+// flags of RCONTAINER_IOCTL_TRYLOCK, RCONTAINER_IOCTL_TIMEDLOCK and RCONTAINER_IOCTL_MULTILOCK
+#define RCONTAINER_LOCK_SHARED      1
+#define RCONTAINER_LOCK_TRY         2   // multilock only: fail with -EAGAIN instead of waiting
+
+#define RCONTAINER_MULTILOCK_MAX    256
+
+// operations of RCONTAINER_IOCTL_ATOMIC
+#define RCONTAINER_ATOMIC_ADD       0   // fetch-and-add
+#define RCONTAINER_ATOMIC_XCHG      1   // exchange
+#define RCONTAINER_ATOMIC_CMPXCHG   2   // compare-and-exchange, result == expected when it succeeded
+
+#define RCONTAINER_ATOMIC_BATCH_MAX 256
+
+// operations of RCONTAINER_IOCTL_BATCH, run in order until one fails
+#define RCONTAINER_OP_LOCK          0
+#define RCONTAINER_OP_RDLOCK        1
+#define RCONTAINER_OP_TRYLOCK       2
+#define RCONTAINER_OP_TRYRDLOCK     3
+#define RCONTAINER_OP_UNLOCK        4
+#define RCONTAINER_OP_FREE          5
+#define RCONTAINER_OP_FETCH_ADD     6
+#define RCONTAINER_OP_XCHG          7
+#define RCONTAINER_OP_CMPXCHG       8
+#define RCONTAINER_OP_NOTIFY        9
+#define RCONTAINER_OP_ALLOC         10  // create object oid of arg bytes without mapping it, no-op if it exists
+
+#define RCONTAINER_BATCH_MAX        256
+
+// Every object has a version counter bumped by RCONTAINER_IOCTL_NOTIFY.
+// RCONTAINER_IOCTL_WAIT sleeps while the version still equals the one passed in, and
+// returns the current version either way.
+// With RCONTAINER_WAIT_NONBLOCK it fails with EAGAIN instead of sleeping.
+// RCONTAINER_WAIT_POLL also arms the device fd, so poll() reports POLLIN once the object
+// is notified; each fd is armed on at most one object. epoll watches the object the fd was armed
+// on when it was added, add the fd again after arming it on another object.
+#define RCONTAINER_WAIT_NONBLOCK    1
+#define RCONTAINER_WAIT_POLL        2
+
+// flags of RCONTAINER_IOCTL_ATTACH
+#define RCONTAINER_ATTACH_CREATE    1   // create the backing file if it does not exist
 
 #endif
@@ -0,0 +1,196 @@
+//////////////////////////////////////////////////////////////////////
+//                     University of California, Riverside
+//
+//
+//
+//                             Copyright 2021
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     Tracepoints of CSE202's Resource Container kernel module, under
+//     events/rcontainer/ in tracefs. ioctl.c defines CREATE_TRACE_POINTS
+//     before including this header, so it must stay the only .c file that does.
+//
+////////////////////////////////////////////////////////////////////////
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rcontainer
+
+#if !defined(RESOURCE_CONTAINER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define RESOURCE_CONTAINER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// a task joins or leaves a container
+DECLARE_EVENT_CLASS(rcontainer_thread,
+    TP_PROTO(int cid, int tid),
+    TP_ARGS(cid, tid),
+    TP_STRUCT__entry(
+        __field(int, cid)
+        __field(int, tid)
+    ),
+    TP_fast_assign(
+        __entry->cid = cid;
+        __entry->tid = tid;
+    ),
+    TP_printk("cid=%d tid=%d", __entry->cid, __entry->tid)
+);
+
+DEFINE_EVENT(rcontainer_thread, rcontainer_create,
+    TP_PROTO(int cid, int tid),
+    TP_ARGS(cid, tid)
+);
+
+DEFINE_EVENT(rcontainer_thread, rcontainer_delete,
+    TP_PROTO(int cid, int tid),
+    TP_ARGS(cid, tid)
+);
+
+// the switch moves the turn of a container from one thread to the next
+TRACE_EVENT(rcontainer_switch,
+    TP_PROTO(int cid, int prev_tid, int next_tid),
+    TP_ARGS(cid, prev_tid, next_tid),
+    TP_STRUCT__entry(
+        __field(int, cid)
+        __field(int, prev_tid)
+        __field(int, next_tid)
+    ),
+    TP_fast_assign(
+        __entry->cid = cid;
+        __entry->prev_tid = prev_tid;
+        __entry->next_tid = next_tid;
+    ),
+    TP_printk("cid=%d prev_tid=%d next_tid=%d", __entry->cid, __entry->prev_tid, __entry->next_tid)
+);
+
+// lock operations that reach the kernel, the user-space fast path is not traced
+DECLARE_EVENT_CLASS(rcontainer_lock,
+    TP_PROTO(int cid, unsigned long oid, int shared),
+    TP_ARGS(cid, oid, shared),
+    TP_STRUCT__entry(
+        __field(int, cid)
+        __field(unsigned long, oid)
+        __field(int, tid)
+        __field(int, shared)
+    ),
+    TP_fast_assign(
+        __entry->cid = cid;
+        __entry->oid = oid;
+        __entry->tid = current->pid;
+        __entry->shared = shared;
+    ),
+    TP_printk("cid=%d oid=%lu tid=%d shared=%d", __entry->cid, __entry->oid, __entry->tid, __entry->shared)
+);
+
+DEFINE_EVENT(rcontainer_lock, rcontainer_lock_wait,
+    TP_PROTO(int cid, unsigned long oid, int shared),
+    TP_ARGS(cid, oid, shared)
+);
+
+DEFINE_EVENT(rcontainer_lock, rcontainer_lock_release,
+    TP_PROTO(int cid, unsigned long oid, int shared),
+    TP_ARGS(cid, oid, shared)
+);
+
+TRACE_EVENT(rcontainer_lock_acquire,
+    TP_PROTO(int cid, unsigned long oid, int shared, u64 wait_ns),
+    TP_ARGS(cid, oid, shared, wait_ns),
+    TP_STRUCT__entry(
+        __field(int, cid)
+        __field(unsigned long, oid)
+        __field(int, tid)
+        __field(int, shared)
+        __field(u64, wait_ns)
+    ),
+    TP_fast_assign(
+        __entry->cid = cid;
+        __entry->oid = oid;
+        __entry->tid = current->pid;
+        __entry->shared = shared;
+        __entry->wait_ns = wait_ns;
+    ),
+    TP_printk("cid=%d oid=%lu tid=%d shared=%d wait_ns=%llu", __entry->cid, __entry->oid, __entry->tid,
+              __entry->shared, __entry->wait_ns)
+);
+
+// an object is mapped, created is set when the mmap created it
+TRACE_EVENT(rcontainer_mmap,
+    TP_PROTO(int cid, unsigned long oid, unsigned long size, int created),
+    TP_ARGS(cid, oid, size, created),
+    TP_STRUCT__entry(
+        __field(int, cid)
+        __field(unsigned long, oid)
+        __field(int, tid)
+        __field(unsigned long, size)
+        __field(int, created)
+    ),
+    TP_fast_assign(
+        __entry->cid = cid;
+        __entry->oid = oid;
+        __entry->tid = current->pid;
+        __entry->size = size;
+        __entry->created = created;
+    ),
+    TP_printk("cid=%d oid=%lu tid=%d size=%lu created=%d", __entry->cid, __entry->oid, __entry->tid,
+              __entry->size, __entry->created)
+);
+
+// a page of an object is faulted in
+TRACE_EVENT(rcontainer_fault,
+    TP_PROTO(unsigned long oid, unsigned long index, int write),
+    TP_ARGS(oid, index, write),
+    TP_STRUCT__entry(
+        __field(unsigned long, oid)
+        __field(unsigned long, index)
+        __field(int, tid)
+        __field(int, write)
+    ),
+    TP_fast_assign(
+        __entry->oid = oid;
+        __entry->index = index;
+        __entry->tid = current->pid;
+        __entry->write = write;
+    ),
+    TP_printk("oid=%lu index=%lu tid=%d write=%d", __entry->oid, __entry->index, __entry->tid, __entry->write)
+);
+
+TRACE_EVENT(rcontainer_free,
+    TP_PROTO(int cid, unsigned long oid),
+    TP_ARGS(cid, oid),
+    TP_STRUCT__entry(
+        __field(int, cid)
+        __field(unsigned long, oid)
+        __field(int, tid)
+    ),
+    TP_fast_assign(
+        __entry->cid = cid;
+        __entry->oid = oid;
+        __entry->tid = current->pid;
+    ),
+    TP_printk("cid=%d oid=%lu tid=%d", __entry->cid, __entry->oid, __entry->tid)
+);
+
+#endif
+
+// the header is not in include/trace/events, tell define_trace.h where to find it again (through -I include)
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE resource_container_trace
+#include <trace/define_trace.h>
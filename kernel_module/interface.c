@@ -48,6 +48,12 @@ extern long resource_container_lock(struct resource_container_cmd __user *user_c
 extern long resource_container_unlock(struct resource_container_cmd __user *user_cmd);
 extern long resource_container_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 extern int resource_container_mmap(struct file *filp, struct vm_area_struct *vma);
+extern int resource_container_open(struct inode *inode, struct file *filp);
+extern int resource_container_release(struct inode *inode, struct file *filp);
+extern __poll_t resource_container_poll(struct file *filp, poll_table *wait);
+extern ssize_t resource_container_read_iter(struct kiocb *iocb, struct iov_iter *to);
+extern ssize_t resource_container_write_iter(struct kiocb *iocb, struct iov_iter *from);
+extern loff_t resource_container_llseek(struct file *filp, loff_t offset, int whence);
 extern int resource_container_init(void);
 extern void resource_container_exit(void);
 
@@ -55,6 +61,14 @@ static const struct file_operations resource_container_fops = {
     .owner                = THIS_MODULE,
     .unlocked_ioctl       = resource_container_ioctl,
     .mmap                 = resource_container_mmap,
+    .open                 = resource_container_open,
+    .release              = resource_container_release,
+    .poll                 = resource_container_poll,
+    .read_iter            = resource_container_read_iter,
+    .write_iter           = resource_container_write_iter,
+    .splice_read          = generic_file_splice_read,
+    .splice_write         = iter_file_splice_write,
+    .llseek               = resource_container_llseek,
 };
 
 struct miscdevice resource_container_dev = {
@@ -46,11 +46,20 @@
 #include <linux/poll.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
+#include <linux/debugfs.h>
 
 extern struct miscdevice resource_container_dev;
+extern void resource_container_debugfs_init(struct dentry* root);
 
 struct mutex mlock;
 struct mutex memorylock;
+struct dentry* resource_container_debugfs;      //debugfs directory of the module, /sys/kernel/debug/rcontainer
+
+// tmpfs directory that holds the backing files of persistent objects, one file per <uid>.<cid>.<oid>
+// Read-only once the module is loaded, persistent_memory_create reads it without a lock.
+char* persist_dir = "/dev/shm/rcontainer";
+module_param(persist_dir, charp, 0444);
+MODULE_PARM_DESC(persist_dir, "tmpfs directory of the backing files of persistent objects");
 
 int resource_container_init(void)
 {
@@ -64,12 +73,15 @@ int resource_container_init(void)
     printk("Resource container kernel module installed\n");
     mutex_init(&mlock);
     mutex_init(&memorylock);
+    resource_container_debugfs = debugfs_create_dir("rcontainer", NULL);
+    resource_container_debugfs_init(resource_container_debugfs);
     return ret;
 }
 
 void resource_container_exit(void)
 {
     printk("Resource container removed\n");
+    debugfs_remove_recursive(resource_container_debugfs);
     misc_deregister(&resource_container_dev);
 }
 
@@ -47,6 +47,28 @@
 #include <linux/mutex.h>
 #include <linux/sched.h>
 #include <linux/kthread.h>
+#include <linux/cred.h>
+#include <linux/capability.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/shmem_fs.h>
+#include <linux/magic.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/cache.h>
+#include <linux/hashtable.h>
+#include <linux/pid.h>
+#include <linux/math64.h>
+
+#define CREATE_TRACE_POINTS
+#include "resource_container_trace.h"
 
 /**
  * Idea for data structure:
@@ -70,6 +92,7 @@
 */
 extern struct mutex mlock;
 extern struct mutex memorylock;
+extern char* persist_dir;
 // typedef struct mutex mutex;
 typedef struct thread_block thread_block;
 typedef struct container_block container_block;
@@ -82,7 +105,13 @@ typedef struct thread_block{
     thread_block* next_thread;      //pointer to the next thread block
     //next thread will be null if it is the last thread
     thread_block* prev_thread;      //pointer to the prev thread block
-    struct task_struct* task_info;  //Use to load the info from current when create   
+    struct task_struct* task_info;  //Use to load the info from current when create, referenced while in a container
+    container_block* container;     //container the thread is in
+    struct hlist_node tid_node;     //entry in thread_hash
+    u64 turns;                      //times the thread got the turn
+    u64 runtime_base;               //sum_exec_runtime of the task when it joined the container
+    u64 parked_ns;                  //time spent waiting for the turn
+    u64 park_start_ns;              //when the thread lost the turn, 0 while it has it
 } thread_block;
 
 typedef struct container_block{
@@ -97,22 +126,67 @@ typedef struct container_block{
     memory_block* last_memory;
     lock_block* first_lock;
     lock_block* last_lock;
+    struct page* lock_page;         //lock words of the container, mapped by the library for the user-space fast path
+    int nr_lock_slots;              //number of slots in lock_page handed out to lock blocks
+    u32 weight;                     //consecutive switch turns the container gets
+    u32 turns;                      //switch turns taken in a row so far
+    u64 timeslice_ns;               //minimum time a thread keeps the turn, 0 rotates on every switch
+    u64 turn_start_ns;              //when running_thread got the turn
+    u64 quota_ns;                   //CPU time budget, recorded for accounting
+    u64 switches;                   //turns moved to another thread by the switch
+    u64 parked_ns;                  //parked time of member threads, for finished waits
+    u64 exited_runtime_ns;          //CPU time of the threads that left the container
+    struct hlist_node cid_node;     //entry in container_hash
+    struct dentry* debugfs;         //debugfs directory <root>/<cid>, NULL if it could not be created
 } container_block;
 
 typedef struct memory_block{
-    void* m_address;
+    struct page** pages;            //backing pages of the object, one entry per page
+    unsigned long nr_pages;         //number of entries in pages
+    unsigned long* cow;             //bit set when the page is shared copy-on-write with a snapshot, NULL if never snapshotted
+    unsigned long* dirty;           //bit set when the page is written after the last checkpoint, NULL if never checkpointed
+    struct file* restore_file;      //for an object restored lazily, the checkpoint its missing pages are read from
+    loff_t* restore_pos;            //offset of every page in restore_file, -1 for a zero page
+    struct mutex page_lock;         //protects pages and cow
+    memory_block* origin;           //for a read-only share, the object that owns the pages
+    struct file* backing_file;      //for a persistent object, the file whose page cache holds the data; pages is unused
     unsigned long int oid;
+    int readonly;                   //set when the object is a read-only share of another container's object
+    atomic_t refs;                  //one for the container list, one for every vma that maps the object
+    atomic_t version;               //bumped by every notify
+    wait_queue_head_t notify_wait;  //tasks sleeping in RCONTAINER_IOCTL_WAIT
     memory_block* next_memory;
     memory_block* prev_memory;
     tid_block* first_tid;
     tid_block* last_tid;
 } memory_block;
 
+// contention counters of a lock, one copy per CPU summed when they are read
+struct lock_stats{
+    u64 acquisitions;               //acquisitions that went through the kernel
+    u64 contended;                  //those that had to sleep
+    u64 wait_ns;
+    u64 wait_max_ns;
+    u64 hold_ns;
+};
+
 typedef struct lock_block{
-    struct mutex* lock;
+    atomic_t* word;                 //lock word, RCONTAINER_LOCK_HELD/RCONTAINER_LOCK_WAITERS; points into the lock page when slot >= 0
+    atomic_t own_word;              //lock word used when the lock page has no free slot
+    u32* seq;                       //sequence counter of the object, next to word
+    u32 own_seq;
+    int slot;                       //slot in the container's lock page, -1 if the lock has no user-space fast path
+    wait_queue_head_t wait;         //tasks sleeping in the slow path
+    struct lock_stats __percpu* stats;
+    u64 acquired_ns;                //when the last exclusive hold taken in the kernel started
+    u32 acquired_seq;               //sequence counter during that hold, the hold may have been released in user space since
+    int holder;                     //tid of the last task that took the lock in the kernel
+    atomic_t waiters;               //tasks sleeping in the slow path right now
+    atomic_t refs;                  //one for the container list, one for every ioctl working on the lock
+    struct page* page;              //reference on the lock page that holds word, NULL when slot < 0
     lock_block* next_lock;
     lock_block* prev_lock;
-    int lid;
+    unsigned long int lid;
     int cid;
 }lock_block;
 
@@ -121,9 +195,60 @@ typedef struct tid_block{
     tid_block* next_tid;
     tid_block* prev_tid;
 } tid_block;
+
+// an object whose notify_wait a poll of the fd registered on
+typedef struct poll_block{
+    memory_block* mblock;           //holding a reference, epoll stays on the waitqueue until the fd is released
+    struct poll_block* next;
+} poll_block;
+
+// state of one open of the device, kept in filp->private_data
+typedef struct file_block{
+    spinlock_t lock;                //protects the fields below
+    memory_block* armed;            //object a nonblocking wait is armed on (holding a reference), NULL if none
+    u32 armed_version;              //version seen when the wait was armed
+    poll_block* polled;             //objects poll registered the fd on, freed on release
+    memory_block* selected;         //object read and write work on (holding a reference), NULL if none
+    struct mutex ring_lock;         //serializes ring setup, mapping and the ring indices, not held while an entry runs
+    void* ring;                     //submission and completion rings, NULL until they are set up
+    size_t ring_size;
+    u32 ring_entries;               //copies of the geometry in the ring header, which user space can overwrite
+    size_t sq_offset;
+    size_t cq_offset;
+    u32 sq_head;                    //kernel copies of the indices it owns, the header only publishes them
+    u32 cq_tail;
+    u32 cq_pending;                 //completions of submissions that are taken and still running
+} file_block;
+int memory_remove(container_block* cblock, memory_block* mblock, tid_block* tblock);
+int memory_populate(memory_block* mblock, unsigned long index);
+void lock_put(lock_block* lblock);
+void container_debugfs_create(container_block* cblock);
+
 container_block* first_container = NULL;        //Use to check the first container
 container_block* last_container = NULL;         //use to check the last container
 container_block* switch_target_container = NULL;    //Use to see which container to do the switch
+static DEFINE_HASHTABLE(container_hash, 8);     //containers by cid
+static DEFINE_HASHTABLE(thread_hash, 10);       //thread blocks by tid, so looking up the caller's container does not scan every container
+
+// latency histograms, one set per CPU so recording never shares a cache line with another CPU
+struct latency_hist{
+    u64 count;
+    u64 sum_ns;
+    u64 buckets[RCONTAINER_LATENCY_BUCKETS];
+};
+struct latency_hists{
+    struct latency_hist op[RCONTAINER_LAT_OPS];
+};
+static DEFINE_PER_CPU(struct latency_hists, latency_hists);
+
+// latency_record: count one operation op that took ns
+static inline void latency_record(int op, u64 ns){
+    int bucket = (ns > 1) ? min(ilog2(ns), RCONTAINER_LATENCY_BUCKETS - 1) : 0;
+
+    this_cpu_inc(latency_hists.op[op].count);
+    this_cpu_add(latency_hists.op[op].sum_ns, ns);
+    this_cpu_inc(latency_hists.op[op].buckets[bucket]);
+}
 
 
 ////////////////////////support function///////////////////////////////
@@ -133,28 +258,12 @@ container_block* switch_target_container = NULL;    //Use to see which container
 // output: NULL if the container does not esist, else the target's container address.
 container_block* search_container_create(int cid){
     container_block* temp;
-    //debug statement
-    // printk("%d: search_container_create begin\n", current->pid);
-    // no container
-    if(first_container == NULL){
-        //debug statement
-        // printk("    %d: search container create return: no container\n", current->pid);
-        return NULL;
-    }
-    
-    temp = first_container;
 
-    //continue to iterate all the container
-    while(temp != NULL){
+    hash_for_each_possible(container_hash, temp, cid_node, cid){
         if(temp->cid == cid){
-            //debug statement
-            // printk("    %d: search container create return: find container\n", current->pid);
             return temp;            //if the current search container match the cid, return the address of that container block
         }
-        temp = temp->next_container;
     }
-    //debug statement
-    // printk("    %d: search container create return: no container\n", current->pid);
     return NULL;            //if iterate all the container but cannot find the target container, return NULL
 }
 
@@ -177,6 +286,18 @@ container_block* new_container_create(int cid){
     new_container->last_memory = NULL;
     new_container->first_lock = NULL;
     new_container->last_lock = NULL;
+    new_container->lock_page = alloc_page(GFP_KERNEL | __GFP_ZERO);     //without it every lock takes the slow path
+    new_container->nr_lock_slots = 0;
+    new_container->weight = 1;
+    new_container->turns = 0;
+    new_container->timeslice_ns = 0;
+    new_container->turn_start_ns = 0;
+    new_container->quota_ns = 0;
+    new_container->switches = 0;
+    new_container->parked_ns = 0;
+    new_container->exited_runtime_ns = 0;
+    container_debugfs_create(new_container);
+    hash_add(container_hash, &new_container->cid_node, cid);
     //if it is the first container created, update first_container and switch_target_container
     if(first_container == NULL){
         first_container = new_container;
@@ -197,34 +318,100 @@ container_block* new_container_create(int cid){
     return new_container;
 }
 
-// new_thread_create: create new thread structure and connect to the container block
-thread_block* new_thread_create(container_block* cblock){
+// thread_park: tblock loses the turn of its container
+void thread_park(thread_block* tblock, u64 now){
+    tblock->park_start_ns = now;
+}
 
-    thread_block* temp = cblock->first_thread;
-    thread_block* new_thread = (thread_block *)kmalloc(sizeof( thread_block ) , GFP_KERNEL);        //allocate space for thread_block
+// thread_unpark: tblock gets the turn of cblock, end its wait
+void thread_unpark(container_block* cblock, thread_block* tblock, u64 now){
+    u64 parked;
 
-    //debug statement
-    // printk("%d: new_thread_create begin\n", current->pid);
-    new_thread->task_info = current;
-    new_thread->cid = cblock->cid;
-    new_thread->next_thread = NULL;
-    new_thread->tid = current->pid;
-    new_thread->prev_thread = NULL;
+    if(tblock->park_start_ns != 0){
+        parked = now - tblock->park_start_ns;
+        tblock->parked_ns += parked;
+        cblock->parked_ns += parked;
+        tblock->park_start_ns = 0;
+    }
+    tblock->turns++;
+}
+
+// thread_runtime: CPU time of tblock since it joined its container
+u64 thread_runtime(thread_block* tblock){
+    return READ_ONCE(tblock->task_info->se.sum_exec_runtime) - tblock->runtime_base;
+}
+
+// thread_parked: time tblock has waited for the turn, including the current wait
+u64 thread_parked(thread_block* tblock, u64 now){
+    return tblock->parked_ns + ((tblock->park_start_ns != 0) ? now - tblock->park_start_ns : 0);
+}
+
+// container_runtime: CPU time of cblock, the member threads plus the threads that left
+u64 container_runtime(container_block* cblock){
+    thread_block* tblock;
+    u64 runtime = cblock->exited_runtime_ns;
+
+    for(tblock = cblock->first_thread; tblock != NULL; tblock = tblock->next_thread){
+        runtime += thread_runtime(tblock);
+    }
+    return runtime;
+}
+
+// container_parked: parked time of cblock, including the threads waiting right now
+u64 container_parked(container_block* cblock, u64 now){
+    thread_block* tblock;
+    u64 parked = cblock->parked_ns;
+
+    for(tblock = cblock->first_thread; tblock != NULL; tblock = tblock->next_thread){
+        if(tblock->park_start_ns != 0){
+            parked += now - tblock->park_start_ns;
+        }
+    }
+    return parked;
+}
+
+// thread_attach: append tblock to the thread list of cblock
+// The first thread of a container gets the turn, the others wait for the switch to reach them.
+void thread_attach(container_block* cblock, thread_block* tblock){
+    u64 now = ktime_get_ns();
+
+    tblock->cid = cblock->cid;
+    tblock->container = cblock;
+    tblock->turns = 0;
+    tblock->runtime_base = READ_ONCE(tblock->task_info->se.sum_exec_runtime);
+    tblock->parked_ns = 0;
+    tblock->park_start_ns = 0;
+    hash_add(thread_hash, &tblock->tid_node, tblock->tid);
+    tblock->next_thread = NULL;
+    tblock->prev_thread = NULL;
     // if first thread is NULL, need to update first thread and last thread to new thread that just created
     // And this thread will be the running thread
-    if(temp == NULL){
-        cblock->first_thread = new_thread;
-        cblock->last_thread = new_thread;
-        cblock->running_thread = new_thread;        
+    if(cblock->first_thread == NULL){
+        cblock->first_thread = tblock;
+        cblock->last_thread = tblock;
+        cblock->running_thread = tblock;
+        cblock->turn_start_ns = now;
+        thread_unpark(cblock, tblock, now);
     }
     // else, it already has at least a thread in the thread list, update the original last thread to point to the new last thread, and update container last thread
-    // Also need to sleep the thread
     else{
-        cblock->last_thread->next_thread = new_thread;
-        new_thread->prev_thread = cblock->last_thread;
-        cblock->last_thread = new_thread;        
-        
+        cblock->last_thread->next_thread = tblock;
+        tblock->prev_thread = cblock->last_thread;
+        cblock->last_thread = tblock;
+        thread_park(tblock, now);
     }
+}
+
+// new_thread_create: create new thread structure and connect to the container block
+thread_block* new_thread_create(container_block* cblock){
+    thread_block* new_thread = (thread_block *)kmalloc(sizeof( thread_block ) , GFP_KERNEL);        //allocate space for thread_block
+
+    //debug statement
+    // printk("%d: new_thread_create begin\n", current->pid);
+    get_task_struct(current);
+    new_thread->task_info = current;
+    new_thread->tid = current->pid;
+    thread_attach(cblock, new_thread);
     //debug statement
     // printk("    %d: new_thread_create return: new thread\n", current->pid);
     return new_thread;
@@ -257,144 +444,169 @@ thread_block* find_tid(int tid, container_block* cblock){
 
 }
 
+// search_thread: find the thread block of tid in any container
+// return the thread block, or NULL if tid is not in a container
+thread_block* search_thread(int tid){
+    thread_block* temp;
+
+    hash_for_each_possible(thread_hash, temp, tid_node, tid){
+        if(temp->tid == tid){
+            return temp;
+        }
+    }
+    return NULL;
+}
+
 //search_all_container_tid: search all the container to see if any contain a thread with target tid
 //return contain_block if find, else return NULL
 container_block* search_all_container_tid(int tid){
-    container_block* temp = first_container;
+    thread_block* temp = search_thread(tid);
 
-    //debug statement
-    // printk("%d: search_all_container_tid begin\n",current->pid);
+    return (temp == NULL) ? NULL : temp->container;
+}
 
-    if(temp == NULL){       //should not happen
-        printk(KERN_ERR "copy from user function fail from find tid\n");
-        return NULL;
+
+// thread_unlink: take tblock out of the thread list of cblock
+// If tblock had the turn, the next thread (or the first one, after the last) gets it and is woken up.
+void thread_unlink(container_block* cblock, thread_block* tblock){
+    thread_block* prev_thread = tblock->prev_thread;
+    thread_block* next_thread = tblock->next_thread;
+    u64 now = ktime_get_ns();
+
+    //the container keeps the time of the threads that leave it
+    cblock->exited_runtime_ns += thread_runtime(tblock);
+    if(tblock->park_start_ns != 0){
+        cblock->parked_ns += now - tblock->park_start_ns;
+        tblock->park_start_ns = 0;
     }
 
-    while(temp != NULL){
-        if(find_tid(tid,temp) != NULL){
-            //debug statement
-            // printk("    %d: search_all_container_tid return: find container\n",current->pid);
-            return temp;
-        }
-        else{
-            temp = temp->next_container;
+    if(prev_thread == NULL){                    //tblock is the first thread
+        cblock->first_thread = next_thread;
+    }
+    else{
+        prev_thread->next_thread = next_thread;
+    }
+    if(next_thread == NULL){                    //tblock is the last thread
+        cblock->last_thread = prev_thread;
+    }
+    else{
+        next_thread->prev_thread = prev_thread;
+    }
+    tblock->prev_thread = NULL;
+    tblock->next_thread = NULL;
+    hash_del(&tblock->tid_node);
+
+    if(cblock->running_thread == tblock){
+        cblock->running_thread = (next_thread != NULL) ? next_thread : cblock->first_thread;
+        cblock->turn_start_ns = now;
+        if(cblock->running_thread != NULL){
+            thread_unpark(cblock, cblock->running_thread, now);
+            wake_up_process(cblock->running_thread->task_info);
         }
     }
-    //debug statement
-    // printk("    %d: search_all_container_tid return: not find container\n",current->pid);
-    return NULL;
 }
 
-
-// thread_remove: use as support for delete a thread, need to have the container that contain the thread as input
-int thread_remove(int tid, container_block* cblock){
-    container_block* prev = NULL;
-    container_block* next = NULL;
-    thread_block* temp = NULL;
-    thread_block* prev_thread = NULL;
-    thread_block* next_thread = NULL;
+// container_destroy: unlink a container that has no thread left and free its locks, objects and lock page
+void container_destroy(container_block* cblock){
+    container_block* prev = cblock->prev_container;
+    container_block* next = cblock->next_container;
     lock_block* curr_lblock;
     lock_block* temp_lblock;
 
-    //debug statement
-    // printk("%d: thread_remove begin\n", current->pid);
-
-    //case 1: only 1 thread within the cblock
-    if(cblock->first_thread == cblock->last_thread){
-        temp = cblock->first_thread;
+    if(prev == NULL && next == NULL){       //if this is the only container
+        first_container = NULL;
+        last_container = NULL;
+    }
+    else if(prev == NULL){                  //if current container is the first one
+        first_container = next;
+        next->prev_container = NULL;
+    }
+    else if(next == NULL){                  //if current container is the last one
+        prev->next_container = NULL;
+        last_container = prev;
+    }
+    else{                                   //if it is a middle container
+        prev->next_container = next;
+        next->prev_container = prev;
+    }
+    if(switch_target_container == cblock){
+        switch_target_container = (next != NULL) ? next : first_container;
+    }
+    hash_del(&cblock->cid_node);
+    debugfs_remove_recursive(cblock->debugfs);      //does not wait for readers, they look the container up by cid
 
-        if(temp->tid != tid){   //check is the tid match, if not, return -1
-            printk(KERN_ERR "seomething wrong with thread remove\n");
-            return -1;
-        }
+    // printk("removing lock\n");
+    curr_lblock = cblock->first_lock;
+    while(curr_lblock != NULL){
+        temp_lblock = curr_lblock;
+        curr_lblock = curr_lblock->next_lock;
+        lock_put(temp_lblock);          //a task sleeping on the lock keeps it until it wakes up
+    }
+    if(cblock->lock_page != NULL){
+        put_page(cblock->lock_page);        //a task may still have it mapped, the mapping keeps its own reference
+    }
 
-        //prepare to remove the container
-        prev = cblock->prev_container;
-        next = cblock->next_container;
+    //objects nobody can reach anymore, mappings keep their own references
+    while(cblock->first_memory != NULL){
+        memory_remove(cblock, cblock->first_memory, NULL);
+    }
 
-        if(prev == NULL && next == NULL){       //if this is the only container
-            first_container = NULL;
-            last_container = NULL;
-            switch_target_container = NULL;
-        }
-        else if(prev == NULL){                  //if current container is the first one
-            first_container = next;
-            next->prev_container = NULL;
-        }
-        else if(next == NULL){                  //if current container is the last one
-            prev->next_container = NULL;
-            last_container = prev;
-        }
-        else{                                   //if it is a middle container
-            prev->next_container = next;
-            next->prev_container = prev;
-        }
-        
-        // printk("removing thread\n");
-        kfree(temp);
+    // printk("removing container\n");
+    kfree(cblock);
+}
 
-        // printk("removing lock\n");
-        curr_lblock = cblock->first_lock;
-        while(curr_lblock != NULL){
-            temp_lblock = curr_lblock;
-            curr_lblock = curr_lblock->next_lock;
-            kfree(temp_lblock->lock);
-            kfree(temp_lblock);
-        }
+// thread_free: free an unlinked thread block and drop its task reference
+void thread_free(thread_block* tblock){
+    put_task_struct(tblock->task_info);
+    kfree(tblock);
+}
 
+// container_reap: remove the threads of cblock that exited without deleting themselves
+// return 1 if cblock was destroyed with its last thread, a container set up without threads is kept
+int container_reap(container_block* cblock){
+    thread_block* tblock = cblock->first_thread;
+    thread_block* next;
+    int reaped = 0;
 
-        // printk("removing container\n");
-        kfree(cblock);
-        
-        //debug statement
-        // printk("    %d: thread_remove return: case 1 success\n", current->pid);
-        return 0;
+    while(tblock != NULL){
+        next = tblock->next_thread;
+        if(tblock->task_info->flags & PF_EXITING){
+            thread_unlink(cblock, tblock);
+            thread_free(tblock);
+            reaped = 1;
+        }
+        tblock = next;
     }
+    if(reaped && cblock->first_thread == NULL){
+        container_destroy(cblock);
+        return 1;
+    }
+    return 0;
+}
 
-    //case 2: more than 1 thread within the cblock
-    else{
-        temp = find_tid(tid,cblock);
-
+// thread_remove: use as support for delete a thread, need to have the container that contain the thread as input
+// The container is destroyed with its last thread.
+int thread_remove(int tid, container_block* cblock){
+    thread_block* temp = find_tid(tid, cblock);
 
-        prev_thread = temp->prev_thread;
-        next_thread = temp->next_thread;
+    //debug statement
+    // printk("%d: thread_remove begin\n", current->pid);
 
-        if(prev_thread == NULL && next_thread == NULL){       // case when it is the only thread, should not happen
-            printk(KERN_ERR "wrong with case 2 in thread remove\n");
-            return -1;
-        }
-        else if(prev_thread == NULL){                  //current thread is the first thread
-            cblock->first_thread = next_thread;
-            next_thread->prev_thread = NULL;
+    if(temp == NULL){
+        printk(KERN_ERR "seomething wrong with thread remove\n");
+        return -1;
+    }
 
-            if(temp == cblock->running_thread){
-                cblock->running_thread = next_thread;
-                wake_up_process(next_thread->task_info);
-            }
-        }
-        else if(next_thread == NULL){                  //current thread is the last thread
-            cblock->last_thread = prev_thread;
-            prev_thread->next_thread = NULL;
-            if(temp == cblock->running_thread){
-                cblock->running_thread = cblock->first_thread;
-                wake_up_process(cblock->first_thread->task_info);
-            }
-        }
-        else{                                   //middle case for thread
-            prev_thread->next_thread = next_thread;
-            next_thread->prev_thread = prev_thread;
-            if(temp == cblock->running_thread){
-                cblock->running_thread = next_thread;
-                wake_up_process(next_thread->task_info);
-            }
-        }
+    thread_unlink(cblock, temp);
+    // printk("removing thread\n");
+    thread_free(temp);
 
-        // printk("removing thread\n");
-        kfree(temp);
-        //debug statement
-        // printk("    %d: thread_remove return: case 2 success\n", current->pid);
-        return 0;
+    if(cblock->first_thread == NULL){
+        container_destroy(cblock);
     }
+    //debug statement
+    // printk("    %d: thread_remove return: success\n", current->pid);
+    return 0;
 }
 
 // print_all_container_thread: use for debug, print all the container and thread
@@ -497,151 +709,833 @@ memory_block* search_memory(container_block* cblock, unsigned long int oid){
     return NULL;    
 }
 
-// create memork and assign it to the container block
-memory_block* new_memory_create(container_block* cblock, unsigned long int oid, unsigned long size){
-    memory_block* new_memory = (memory_block *)kmalloc(sizeof( memory_block ) , GFP_KERNEL);
-    new_memory->oid = oid;
-    new_memory->m_address = kzalloc(size, GFP_KERNEL);
-    new_memory->next_memory = NULL; 
-    new_memory->first_tid = NULL;
-    new_memory->last_tid = NULL;   
+// memory_link: append a memory block to the memory list of the container
+void memory_link(container_block* cblock, memory_block* mblock){
+    mblock->next_memory = NULL;
     if(cblock->first_memory == NULL){
-        cblock->first_memory = new_memory;
-        cblock->last_memory = new_memory;
-        new_memory->prev_memory = NULL;
+        cblock->first_memory = mblock;
+        cblock->last_memory = mblock;
+        mblock->prev_memory = NULL;
     }
     else{
-        new_memory->prev_memory = cblock->last_memory;
-        cblock->last_memory->next_memory = new_memory;
-        cblock->last_memory = new_memory;
+        mblock->prev_memory = cblock->last_memory;
+        cblock->last_memory->next_memory = mblock;
+        cblock->last_memory = mblock;
     }
-    return new_memory;
-
 }
 
-// search to see do a lock block exist in the container
-lock_block* search_lock(container_block* cblock, int lid){
-    lock_block* temp = cblock->first_lock;
-    while(temp != NULL){
-        // printk("%d: temp oid = %lu", current->pid, temp->oid);
-        if(temp->lid == lid){
-            return temp;
-        }
-        else{
-            temp = temp->next_lock;
-        }
+// memory_unlink: take a memory block out of the memory list of the container, the block itself is not freed
+void memory_unlink(container_block* cblock, memory_block* mblock){
+    if(mblock->prev_memory == NULL){        //target is the first memory block
+        cblock->first_memory = mblock->next_memory;
     }
-
-    return NULL;
+    else{
+        mblock->prev_memory->next_memory = mblock->next_memory;
+    }
+    if(mblock->next_memory == NULL){        //target is the last memory block
+        cblock->last_memory = mblock->prev_memory;
+    }
+    else{
+        mblock->next_memory->prev_memory = mblock->prev_memory;
+    }
+    mblock->next_memory = NULL;
+    mblock->prev_memory = NULL;
 }
 
+// memory_tid_clear: drop all the tid blocks recorded for the memory block
+void memory_tid_clear(memory_block* mblock){
+    tid_block* curr = mblock->first_tid;
+    tid_block* temp;
+    while(curr != NULL){
+        temp = curr;
+        curr = curr->next_tid;
+        kfree(temp);
+    }
+    mblock->first_tid = NULL;
+    mblock->last_tid = NULL;
+}
 
-lock_block* new_lock_create(container_block* cblock, int lid){
-    lock_block* new_memory = (lock_block *)kmalloc(sizeof( lock_block ) , GFP_KERNEL);
-    new_memory->lid = lid;
-    new_memory->cid = cblock->cid;
-    new_memory->lock =  (struct mutex *)kmalloc(sizeof( struct mutex ) , GFP_KERNEL);
-    mutex_init(new_memory->lock);
-    new_memory->next_lock = NULL;
-    new_memory->prev_lock = NULL;
-    if(cblock->first_lock == NULL){
-        cblock->first_lock = new_memory;
-        cblock->last_lock = new_memory;
+// memory_put: drop one reference of the memory block, the pages are released with the last reference
+void memory_put(memory_block* mblock){
+    unsigned long i;
+    if(!atomic_dec_and_test(&mblock->refs)){
+        return;
+    }
+    if(mblock->origin != NULL){
+        memory_put(mblock->origin);
+    }
+    else if(mblock->backing_file != NULL){
+        fput(mblock->backing_file);         //the file and its data stay for the next attach
     }
     else{
-        new_memory->prev_lock = cblock->last_lock;
-        cblock->last_lock->next_lock = new_memory;
-        cblock->last_lock = new_memory;
+        for(i = 0; i < mblock->nr_pages; i++){
+            if(mblock->pages[i] != NULL){
+                put_page(mblock->pages[i]);
+            }
+        }
+    }
+    if(mblock->restore_file != NULL){
+        fput(mblock->restore_file);
+    }
+    kvfree(mblock->restore_pos);
+    kvfree(mblock->pages);
+    bitmap_free(mblock->cow);
+    bitmap_free(mblock->dirty);
+    kfree(mblock);
+}
+
+// memory_block_alloc: allocate a memory block with an empty page array of nr_pages entries
+memory_block* memory_block_alloc(unsigned long int oid, unsigned long nr_pages){
+    memory_block* new_memory = (memory_block *)kmalloc(sizeof( memory_block ) , GFP_KERNEL);
+    if(new_memory == NULL){
+        return NULL;
+    }
+    new_memory->pages = (struct page **)kvcalloc(nr_pages, sizeof(struct page *), GFP_KERNEL);
+    if(new_memory->pages == NULL){
+        kfree(new_memory);
+        return NULL;
     }
+    new_memory->nr_pages = nr_pages;
+    new_memory->cow = NULL;
+    new_memory->dirty = NULL;
+    new_memory->restore_file = NULL;
+    new_memory->restore_pos = NULL;
+    mutex_init(&new_memory->page_lock);
+    new_memory->origin = NULL;
+    new_memory->backing_file = NULL;
+    new_memory->oid = oid;
+    new_memory->readonly = 0;
+    atomic_set(&new_memory->refs, 1);
+    atomic_set(&new_memory->version, 0);
+    init_waitqueue_head(&new_memory->notify_wait);
+    new_memory->next_memory = NULL;
+    new_memory->prev_memory = NULL;
+    new_memory->first_tid = NULL;
+    new_memory->last_tid = NULL;
     return new_memory;
 }
 
-tid_block* search_memory_tid(memory_block* mblock, int tid){
-    tid_block* temp = mblock->first_tid;
-    while(temp != NULL){
-        if(temp->tid == tid){
-            return temp;
+// memory_backing: the memory block that owns the pages of mblock
+memory_block* memory_backing(memory_block* mblock){
+    return (mblock->origin != NULL) ? mblock->origin : mblock;
+}
+
+// create memork and assign it to the container block
+// The object is backed by individual pages instead of one kzalloc buffer, so the pages can be handed to
+// another container without copying and the object is not limited by the largest contiguous allocation.
+memory_block* new_memory_create(container_block* cblock, unsigned long int oid, unsigned long size){
+    unsigned long i;
+    memory_block* new_memory = memory_block_alloc(oid, PAGE_ALIGN(size) >> PAGE_SHIFT);
+    if(new_memory == NULL){
+        return NULL;
+    }
+    for(i = 0; i < new_memory->nr_pages; i++){
+        new_memory->pages[i] = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+        if(new_memory->pages[i] == NULL){
+            memory_put(new_memory);
+            return NULL;
         }
-        temp = temp->next_tid;
     }
-    return NULL;
+    memory_link(cblock, new_memory);
+    return new_memory;
+
 }
 
-tid_block* new_memory_tid_create(memory_block* mblock, int tid){
-    tid_block* temp = (tid_block *)kmalloc(sizeof( tid_block ) , GFP_KERNEL);
-    temp->tid = tid;
-    temp->next_tid = NULL;
-    temp->prev_tid = NULL;
-    if(mblock->first_tid == NULL){
-        mblock->first_tid = temp;
-        mblock->last_tid = temp;
-    }
-    else{
-        mblock->last_tid->next_tid = temp;
-        temp->prev_tid = mblock->last_tid;
-        mblock->last_tid = temp;
+// memory_share_create: create a read-only memory block in cblock that views the pages of mblock
+// The share keeps a reference on the owner, so later copy-on-write breaks in the owner stay visible to it.
+memory_block* memory_share_create(container_block* cblock, memory_block* mblock){
+    memory_block* origin = memory_backing(mblock);
+    memory_block* new_memory = memory_block_alloc(mblock->oid, 0);
+    if(new_memory == NULL){
+        return NULL;
     }
-    return temp;    
+    atomic_inc(&origin->refs);
+    new_memory->origin = origin;
+    new_memory->nr_pages = origin->nr_pages;
+    new_memory->readonly = 1;
+    memory_link(cblock, new_memory);
+    return new_memory;
 }
 
-int memory_remove(container_block* cblock, memory_block* mblock, tid_block* tblock){
-    if(mblock->first_tid == tblock && mblock->last_tid == tblock){          //only 1 tid using the memory
-        kfree(tblock);
+// memory_snapshot_copy: fill the pages of a snapshot by copying a persistent object's file.
+// Page cache pages belong to the file, so they cannot be shared copy-on-write like anonymous object pages.
+int memory_snapshot_copy(memory_block* new_memory, memory_block* origin){
+    unsigned long i;
+    loff_t pos;
+    ssize_t count;
+    void* address;
 
-        if(mblock->prev_memory == NULL && mblock->next_memory == NULL){     //if only 1 memory block for container
-            kfree(mblock->m_address);
-            kfree(mblock);
-            cblock->first_memory = NULL;
-            cblock->last_memory = NULL;
-        }
-        else if(mblock->prev_memory == NULL){       //more than 1 memory block, but the target is the first memory block
-            cblock->first_memory = mblock->next_memory;
-            mblock->next_memory->prev_memory = NULL;
-            kfree(mblock->m_address);
-            kfree(mblock);
-        }
-        else if(mblock->next_memory == NULL){       //more than 1 memory block, but the target is the last memory block
-            cblock->last_memory = mblock->prev_memory;
-            mblock->prev_memory->next_memory = NULL;
-            kfree(mblock->m_address);
-            kfree(mblock);
-        }
-        else{                                       //more than 1 memory block, and the target is in the middle block
-            mblock->prev_memory->next_memory = mblock->next_memory;
-            mblock->next_memory->prev_memory = mblock->prev_memory;
-            kfree(mblock->m_address);
-            kfree(mblock);
+    for(i = 0; i < new_memory->nr_pages; i++){
+        new_memory->pages[i] = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+        if(new_memory->pages[i] == NULL){
+            return -ENOMEM;
+        }
+        pos = (loff_t)i << PAGE_SHIFT;
+        address = kmap(new_memory->pages[i]);
+        count = kernel_read(origin->backing_file, address, PAGE_SIZE, &pos);
+        kunmap(new_memory->pages[i]);
+        if(count < 0){
+            return count;
         }
-        // printk("%d: Success remove tid and memory", current->pid);
     }
+    return 0;
+}
 
-    else if(mblock->first_tid == tblock){       //tblock is the first tid block for the memory
-        mblock->first_tid = tblock->next_tid;
-        tblock->next_tid->prev_tid = NULL;
-        kfree(tblock);
+// memory_snapshot_create: create a memory block with oid in cblock that shares every page of mblock copy-on-write
+memory_block* memory_snapshot_create(container_block* cblock, memory_block* mblock, unsigned long int oid){
+    unsigned long i;
+    memory_block* origin = memory_backing(mblock);
+    memory_block* new_memory = memory_block_alloc(oid, origin->nr_pages);
+    if(new_memory == NULL){
+        return NULL;
     }
-    else if(mblock->last_tid == tblock){        //tblock is the last tid block for the memory
-        mblock->last_tid = tblock->prev_tid;
-        tblock->prev_tid->next_tid = NULL;
-        kfree(tblock);
+    if(origin->backing_file != NULL){
+        if(memory_snapshot_copy(new_memory, origin)){
+            memory_put(new_memory);
+            return NULL;
+        }
+        memory_link(cblock, new_memory);
+        return new_memory;
     }
-    else{                                       //tblock is the middle block for the memory
-        tblock->prev_tid->next_tid = tblock->next_tid;
-        tblock->next_tid->prev_tid = tblock->prev_tid;
-        kfree(tblock);
+    new_memory->cow = bitmap_zalloc(origin->nr_pages, GFP_KERNEL);
+    if(new_memory->cow == NULL){
+        memory_put(new_memory);
+        return NULL;
     }
 
-    // printk("%d: Success remove tid", current->pid);
-    return 0;
-}
+    mutex_lock(&origin->page_lock);
+    for(i = 0; i < origin->nr_pages; i++){
+        if(memory_populate(origin, i)){
+            mutex_unlock(&origin->page_lock);
+            memory_put(new_memory);
+            return NULL;
+        }
+    }
+    if(origin->cow == NULL){
+        origin->cow = bitmap_zalloc(origin->nr_pages, GFP_KERNEL);
+        if(origin->cow == NULL){
+            mutex_unlock(&origin->page_lock);
+            memory_put(new_memory);
+            return NULL;
+        }
+    }
+    for(i = 0; i < origin->nr_pages; i++){
+        get_page(origin->pages[i]);
+        new_memory->pages[i] = origin->pages[i];
+        set_bit(i, origin->cow);
+        set_bit(i, new_memory->cow);
+    }
+    mutex_unlock(&origin->page_lock);
 
+    memory_link(cblock, new_memory);
+    return new_memory;
+}
 
+// memory_populate: make sure page index of mblock exists. Only objects restored lazily have missing pages,
+// they are read from the checkpoint on first use. Caller holds mblock->page_lock.
+// return 0 on success, or a negative error
+int memory_populate(memory_block* mblock, unsigned long index){
+    struct page* page;
+    void* address;
+    loff_t pos;
+    ssize_t ret = PAGE_SIZE;
 
-/**
- * Deregister the task from the container.
- * user_cmd does not contain useful information
- * Need to use current to get the tid and search from it
- */
+    if(mblock->pages[index] != NULL){
+        return 0;
+    }
+    page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+    if(page == NULL){
+        return -ENOMEM;
+    }
+    if(mblock->restore_pos != NULL && mblock->restore_pos[index] >= 0){
+        pos = mblock->restore_pos[index];
+        address = kmap(page);
+        ret = kernel_read(mblock->restore_file, address, PAGE_SIZE, &pos);
+        kunmap(page);
+    }
+    if(ret != PAGE_SIZE){
+        put_page(page);
+        return (ret < 0) ? ret : -EIO;
+    }
+    mblock->pages[index] = page;
+    return 0;
+}
+
+// memory_mark_dirty: record a write to page index for the next incremental checkpoint. Caller holds mblock->page_lock.
+void memory_mark_dirty(memory_block* mblock, unsigned long index){
+    if(mblock->dirty != NULL){
+        set_bit(index, mblock->dirty);
+    }
+}
+
+// memory_cow_break: give mblock a private copy of page index if it is still shared with a snapshot.
+// Caller holds mblock->page_lock. Mappings of the old page are zapped so every task refaults onto the copy.
+// return 0 on success, -ENOMEM if the copy cannot be allocated
+int memory_cow_break(memory_block* mblock, unsigned long index, struct address_space* mapping){
+    struct page* old_page;
+    struct page* new_page;
+
+    if(mblock->cow == NULL || !test_bit(index, mblock->cow)){
+        return 0;
+    }
+    old_page = mblock->pages[index];
+    clear_bit(index, mblock->cow);
+    if(page_count(old_page) == 1){          //the other side already let the page go, nothing to copy
+        return 0;
+    }
+    new_page = alloc_page(GFP_HIGHUSER);
+    if(new_page == NULL){
+        set_bit(index, mblock->cow);
+        return -ENOMEM;
+    }
+    copy_highpage(new_page, old_page);
+    mblock->pages[index] = new_page;
+    unmap_mapping_range(mapping, (loff_t)(mblock->oid + index) << PAGE_SHIFT, PAGE_SIZE, 1);
+    put_page(old_page);
+    return 0;
+}
+
+// memory_get_page: return page index of the object with a reference the caller drops with put_page.
+// For a write on an object page still shared with a snapshot, the sharing is broken first.
+// Pages of a persistent object are read from the page cache of its tmpfs file (and marked dirty by the caller after a write).
+// return the page, or an ERR_PTR
+struct page* memory_get_page(memory_block* mblock, unsigned long index, int write, struct address_space* mapping){
+    memory_block* backing = memory_backing(mblock);
+    struct file* file = backing->backing_file;
+    struct page* page;
+    int ret;
+
+    if(index >= backing->nr_pages){
+        return ERR_PTR(-EINVAL);
+    }
+    if(write && mblock->readonly){
+        return ERR_PTR(-EACCES);
+    }
+    if(file != NULL){
+        return shmem_read_mapping_page(file->f_mapping, index);
+    }
+
+    mutex_lock(&backing->page_lock);
+    ret = memory_populate(backing, index);
+    if(ret == 0 && write){
+        ret = memory_cow_break(backing, index, mapping);
+        memory_mark_dirty(backing, index);
+    }
+    if(ret){
+        mutex_unlock(&backing->page_lock);
+        return ERR_PTR(ret);
+    }
+    page = backing->pages[index];
+    get_page(page);
+    mutex_unlock(&backing->page_lock);
+    return page;
+}
+
+// memory_atomic: run one atomic operation of cmd on the object word it names, cmd->result gets the old value
+// return 0 on success, or a negative error
+int memory_atomic(memory_block* mblock, struct resource_container_atomic_cmd* cmd, struct address_space* mapping){
+    struct page* page;
+    void* address;
+
+    if((cmd->size != 4 && cmd->size != 8) || (cmd->offset & (cmd->size - 1))){
+        return -EINVAL;
+    }
+    if(cmd->op > RCONTAINER_ATOMIC_CMPXCHG){
+        return -EINVAL;
+    }
+    page = memory_get_page(mblock, cmd->offset >> PAGE_SHIFT, 1, mapping);
+    if(IS_ERR(page)){
+        return PTR_ERR(page);
+    }
+
+    address = kmap_atomic(page) + offset_in_page(cmd->offset);
+    if(cmd->size == 4){
+        switch(cmd->op){
+        case RCONTAINER_ATOMIC_ADD:
+            cmd->result = (u32)atomic_fetch_add((int)cmd->value, (atomic_t *)address);
+            break;
+        case RCONTAINER_ATOMIC_XCHG:
+            cmd->result = (u32)atomic_xchg((atomic_t *)address, (int)cmd->value);
+            break;
+        case RCONTAINER_ATOMIC_CMPXCHG:
+            cmd->result = (u32)atomic_cmpxchg((atomic_t *)address, (int)cmd->expected, (int)cmd->value);
+            break;
+        }
+    }
+    else{
+        switch(cmd->op){
+        case RCONTAINER_ATOMIC_ADD:
+            cmd->result = atomic64_fetch_add(cmd->value, (atomic64_t *)address);
+            break;
+        case RCONTAINER_ATOMIC_XCHG:
+            cmd->result = atomic64_xchg((atomic64_t *)address, cmd->value);
+            break;
+        case RCONTAINER_ATOMIC_CMPXCHG:
+            cmd->result = atomic64_cmpxchg((atomic64_t *)address, cmd->expected, cmd->value);
+            break;
+        }
+    }
+    kunmap_atomic(address);
+
+    if(memory_backing(mblock)->backing_file != NULL){
+        set_page_dirty_lock(page);
+    }
+    put_page(page);
+    return 0;
+}
+
+// persistent_memory_create: create a memory block in cblock backed by the file <persist_dir>/<uid>.<cid>.<oid>
+// The file name carries the caller's uid, so a task of another user that picks the same cid gets a file of its own.
+// size 0 reattaches the file with its current size, otherwise the file is extended to at least size bytes.
+// return the memory block, or an ERR_PTR
+memory_block* persistent_memory_create(container_block* cblock, unsigned long int oid, unsigned long size, int create){
+    memory_block* new_memory;
+    struct file* file;
+    char* path;
+    loff_t file_size;
+    int ret;
+
+    path = kasprintf(GFP_KERNEL, "%s/%u.%d.%lu", persist_dir, from_kuid(&init_user_ns, current_fsuid()), cblock->cid, oid);
+    if(path == NULL){
+        return ERR_PTR(-ENOMEM);
+    }
+    file = filp_open(path, O_RDWR | O_LARGEFILE | O_NOFOLLOW | (create ? O_CREAT : 0), 0600);
+    kfree(path);
+    if(IS_ERR(file)){
+        return (memory_block *)file;
+    }
+    //a file planted under the caller's name by someone else is not the caller's object
+    if(!uid_eq(file_inode(file)->i_uid, current_fsuid()) && !capable(CAP_SYS_ADMIN)){
+        fput(file);
+        return ERR_PTR(-EACCES);
+    }
+    //pages are taken with shmem_read_mapping_page, other file systems would need their own locking and writeback
+    if(file_inode(file)->i_sb->s_magic != TMPFS_MAGIC){
+        fput(file);
+        return ERR_PTR(-EOPNOTSUPP);
+    }
+
+    file_size = i_size_read(file_inode(file));
+    if(size > file_size){
+        ret = vfs_truncate(&file->f_path, size);
+        if(ret){
+            fput(file);
+            return ERR_PTR(ret);
+        }
+        file_size = size;
+    }
+    if(file_size == 0){
+        fput(file);
+        return ERR_PTR(-ENODATA);
+    }
+
+    new_memory = memory_block_alloc(oid, 0);
+    if(new_memory == NULL){
+        fput(file);
+        return ERR_PTR(-ENOMEM);
+    }
+    new_memory->backing_file = file;
+    new_memory->nr_pages = PAGE_ALIGN(file_size) >> PAGE_SHIFT;
+    memory_link(cblock, new_memory);
+    return new_memory;
+}
+
+// search to see do a lock block exist in the container
+lock_block* search_lock(container_block* cblock, unsigned long int lid){
+    lock_block* temp = cblock->first_lock;
+    while(temp != NULL){
+        // printk("%d: temp oid = %lu", current->pid, temp->oid);
+        if(temp->lid == lid){
+            return temp;
+        }
+        else{
+            temp = temp->next_lock;
+        }
+    }
+
+    return NULL;
+}
+
+
+// new_lock_create: create the lock block of lid, the lock word goes to the next free slot of the container's lock page
+lock_block* new_lock_create(container_block* cblock, unsigned long int lid){
+    struct resource_container_lock_slot* slots;
+    lock_block* new_memory = (lock_block *)kmalloc(sizeof( lock_block ) , GFP_KERNEL);
+    if(new_memory == NULL){
+        return NULL;
+    }
+    new_memory->lid = lid;
+    new_memory->cid = cblock->cid;
+    atomic_set(&new_memory->own_word, 0);
+    new_memory->own_seq = 0;
+    init_waitqueue_head(&new_memory->wait);
+    new_memory->stats = alloc_percpu(struct lock_stats);
+    if(new_memory->stats == NULL){
+        kfree(new_memory);
+        return NULL;
+    }
+    new_memory->acquired_ns = 0;
+    new_memory->acquired_seq = 0;
+    new_memory->holder = 0;
+    atomic_set(&new_memory->waiters, 0);
+    atomic_set(&new_memory->refs, 1);
+    if(cblock->lock_page != NULL && cblock->nr_lock_slots < RCONTAINER_LOCK_SLOTS){
+        slots = page_address(cblock->lock_page);
+        new_memory->slot = cblock->nr_lock_slots++;
+        slots[new_memory->slot].oid = lid;
+        new_memory->word = (atomic_t *)&slots[new_memory->slot].word;
+        new_memory->seq = &slots[new_memory->slot].seq;
+        new_memory->page = cblock->lock_page;
+        get_page(new_memory->page);         //the word lives there, it must outlive the container
+    }
+    else{
+        new_memory->slot = -1;
+        new_memory->word = &new_memory->own_word;
+        new_memory->seq = &new_memory->own_seq;
+        new_memory->page = NULL;
+    }
+    new_memory->next_lock = NULL;
+    new_memory->prev_lock = NULL;
+    if(cblock->first_lock == NULL){
+        cblock->first_lock = new_memory;
+        cblock->last_lock = new_memory;
+    }
+    else{
+        new_memory->prev_lock = cblock->last_lock;
+        cblock->last_lock->next_lock = new_memory;
+        cblock->last_lock = new_memory;
+    }
+    return new_memory;
+}
+
+// lock_put: drop one reference of the lock block, it is freed with the last one
+void lock_put(lock_block* lblock){
+    if(!atomic_dec_and_test(&lblock->refs)){
+        return;
+    }
+    if(lblock->page != NULL){
+        put_page(lblock->page);
+    }
+    free_percpu(lblock->stats);
+    kfree(lblock);
+}
+
+// lock_lookup: find (or create) the lock block of oid for the container registered by the current task
+// The block comes with a reference, so it stays valid while the caller sleeps on it even if the container
+// is destroyed meanwhile. Drop it with lock_put.
+lock_block* lock_lookup(unsigned long int oid){
+    container_block* cblock;
+    lock_block* lblock = NULL;
+
+    mutex_lock(&mlock);
+    cblock = search_all_container_tid(current->pid);
+    if(cblock != NULL){
+        lblock = search_lock(cblock, oid);
+        if(lblock == NULL){
+            lblock = new_lock_create(cblock, oid);
+        }
+    }
+    if(lblock != NULL){
+        atomic_inc(&lblock->refs);
+    }
+    mutex_unlock(&mlock);
+    return lblock;
+}
+
+// lock_lookup_many: find (or create) the lock blocks of count oids with a single pass under mlock,
+// each with a reference like lock_lookup
+// return 0 on success, -EINVAL if the current task has no container, -ENOMEM if a lock block cannot be created
+int lock_lookup_many(u64* oids, int count, lock_block** lblocks){
+    container_block* cblock;
+    int i, ret = 0;
+
+    mutex_lock(&mlock);
+    cblock = search_all_container_tid(current->pid);
+    if(cblock == NULL){
+        ret = -EINVAL;
+    }
+    for(i = 0; i < count && ret == 0; i++){
+        lblocks[i] = search_lock(cblock, oids[i]);
+        if(lblocks[i] == NULL){
+            lblocks[i] = new_lock_create(cblock, oids[i]);
+        }
+        if(lblocks[i] == NULL){
+            ret = -ENOMEM;
+            break;
+        }
+        atomic_inc(&lblocks[i]->refs);
+    }
+    if(ret){
+        while(i-- > 0){
+            lock_put(lblocks[i]);
+        }
+    }
+    mutex_unlock(&mlock);
+    return ret;
+}
+
+// lock_seq_begin/lock_seq_end: make the sequence counter odd while the lock is held exclusively,
+// so optimistic readers in user space notice a writer and retry.
+// Only the parity is checked: the library ends the sequence itself before it falls back to the unlock ioctl.
+void lock_seq_begin(lock_block* lblock){
+    if(!(*lblock->seq & 1)){
+        WRITE_ONCE(*lblock->seq, *lblock->seq + 1);
+    }
+    smp_wmb();
+}
+
+void lock_seq_end(lock_block* lblock){
+    smp_wmb();
+    if(*lblock->seq & 1){
+        WRITE_ONCE(*lblock->seq, *lblock->seq + 1);
+    }
+}
+
+// lock_word_acquire: try to take the lock word, shared or exclusive, and announce a waiter in the word if it is busy.
+// Used as the wait_event condition, so the waiter bits are set after the task is on the wait queue.
+// A waiting exclusive locker also sets RCONTAINER_LOCK_WRITER_WAITING so new shared lockers queue behind it.
+// return true if the lock is taken
+bool lock_word_acquire(lock_block* lblock, int shared){
+    int old = atomic_read(lblock->word);
+    int busy, waiting;
+
+    if(shared){
+        busy = RCONTAINER_LOCK_HELD | RCONTAINER_LOCK_WRITER_WAITING;
+        waiting = RCONTAINER_LOCK_WAITERS;
+    }
+    else{
+        busy = RCONTAINER_LOCK_HELD | RCONTAINER_LOCK_READERS;
+        waiting = RCONTAINER_LOCK_WAITERS | RCONTAINER_LOCK_WRITER_WAITING;
+    }
+    while(1){
+        if(!(old & busy)){
+            if(atomic_try_cmpxchg(lblock->word, &old, shared ? old + 1 : old | RCONTAINER_LOCK_HELD)){
+                if(!shared){
+                    lock_seq_begin(lblock);
+                }
+                return true;
+            }
+        }
+        else if((old & waiting) == waiting){
+            return false;
+        }
+        else if(atomic_try_cmpxchg(lblock->word, &old, old | waiting)){
+            return false;
+        }
+    }
+}
+
+// lock_word_trylock: take the lock word, shared or exclusive, only if that does not need to wait.
+// Unlike lock_word_acquire it leaves no waiter bit behind when it fails.
+bool lock_word_trylock(lock_block* lblock, int shared){
+    int old = atomic_read(lblock->word);
+    int busy = shared ? (RCONTAINER_LOCK_HELD | RCONTAINER_LOCK_WRITER_WAITING) : (RCONTAINER_LOCK_HELD | RCONTAINER_LOCK_READERS);
+
+    while(!(old & busy)){
+        if(atomic_try_cmpxchg(lblock->word, &old, shared ? old + 1 : old | RCONTAINER_LOCK_HELD)){
+            if(!shared){
+                lock_seq_begin(lblock);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// lock_stat_acquired: account an acquisition made in the kernel, wait_ns is the time slept for it (0 if uncontended)
+void lock_stat_acquired(lock_block* lblock, int shared, u64 wait_ns){
+    struct lock_stats* stats = get_cpu_ptr(lblock->stats);
+
+    stats->acquisitions++;
+    if(wait_ns){
+        stats->contended++;
+        stats->wait_ns += wait_ns;
+        if(wait_ns > stats->wait_max_ns){
+            stats->wait_max_ns = wait_ns;
+        }
+    }
+    put_cpu_ptr(lblock->stats);
+    trace_rcontainer_lock_acquire(lblock->cid, lblock->lid, shared, wait_ns);
+    WRITE_ONCE(lblock->holder, current->pid);
+    if(!shared){
+        lblock->acquired_ns = ktime_get_ns();
+        lblock->acquired_seq = READ_ONCE(*lblock->seq);
+    }
+}
+
+// lock_stat_sum: add up the per-CPU counters of lblock into sum
+void lock_stat_sum(lock_block* lblock, struct lock_stats* sum){
+    struct lock_stats* stats;
+    int cpu;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu){
+        stats = per_cpu_ptr(lblock->stats, cpu);
+        sum->acquisitions += stats->acquisitions;
+        sum->contended += stats->contended;
+        sum->wait_ns += stats->wait_ns;
+        sum->hold_ns += stats->hold_ns;
+        if(stats->wait_max_ns > sum->wait_max_ns){
+            sum->wait_max_ns = stats->wait_max_ns;
+        }
+    }
+}
+
+// lock_slot_acquisitions: acquisitions the library made in user space on the slot of lblock
+u64 lock_slot_acquisitions(container_block* cblock, lock_block* lblock){
+    struct resource_container_lock_slot* slots;
+
+    if(lblock->slot < 0){
+        return 0;
+    }
+    slots = page_address(cblock->lock_page);
+    return READ_ONCE(slots[lblock->slot].acquisitions);
+}
+
+// lock_wait: take the lock word, sleeping (killable) while it is busy, and account the acquisition
+// return 0 once the lock is held, -EINTR if the task was killed while waiting
+int lock_wait(lock_block* lblock, int shared){
+    u64 start;
+
+    if(lock_word_trylock(lblock, shared)){
+        lock_stat_acquired(lblock, shared, 0);
+        return 0;
+    }
+    start = ktime_get_ns();
+    trace_rcontainer_lock_wait(lblock->cid, lblock->lid, shared);
+    atomic_inc(&lblock->waiters);
+    //killable, so a task waiting on a lock whose holder went away can still be killed
+    if(wait_event_killable(lblock->wait, lock_word_acquire(lblock, shared))){
+        atomic_dec(&lblock->waiters);
+        return -EINTR;
+    }
+    atomic_dec(&lblock->waiters);
+    lock_stat_acquired(lblock, shared, max_t(u64, ktime_get_ns() - start, 1));
+    return 0;
+}
+
+// lock_word_release: drop an exclusive or shared hold of the lock word.
+// When the lock becomes free the waiter bits are cleared and every waiter is woken, they set the bits again if they lose the race.
+// return -EPERM if the lock is not held; the word records no owner, so a hold by another task is not caught
+int lock_word_release(lock_block* lblock){
+    int old = atomic_read(lblock->word);
+    int new;
+
+    if(old & RCONTAINER_LOCK_HELD){
+        //every exclusive lock bumps the sequence counter, so an unchanged one means this is the hold that was timed
+        if(lblock->acquired_seq == READ_ONCE(*lblock->seq) && (lblock->acquired_seq & 1)){
+            this_cpu_add(lblock->stats->hold_ns, ktime_get_ns() - lblock->acquired_ns);
+            lblock->acquired_seq = 0;
+        }
+        lock_seq_end(lblock);
+    }
+    do{
+        if(old & RCONTAINER_LOCK_HELD){
+            new = old & ~RCONTAINER_LOCK_HELD;
+        }
+        else if(old & RCONTAINER_LOCK_READERS){
+            new = old - 1;
+        }
+        else{
+            return -EPERM;
+        }
+        if(!(new & RCONTAINER_LOCK_READERS)){
+            new &= ~(RCONTAINER_LOCK_WAITERS | RCONTAINER_LOCK_WRITER_WAITING);
+        }
+    } while(!atomic_try_cmpxchg(lblock->word, &old, new));
+    trace_rcontainer_lock_release(lblock->cid, lblock->lid, !(old & RCONTAINER_LOCK_HELD));
+
+    if((old & RCONTAINER_LOCK_WAITERS) && !(new & RCONTAINER_LOCK_WAITERS)){
+        wake_up_all(&lblock->wait);
+    }
+    return 0;
+}
+
+tid_block* search_memory_tid(memory_block* mblock, int tid){
+    tid_block* temp = mblock->first_tid;
+    while(temp != NULL){
+        if(temp->tid == tid){
+            return temp;
+        }
+        temp = temp->next_tid;
+    }
+    return NULL;
+}
+
+tid_block* new_memory_tid_create(memory_block* mblock, int tid){
+    tid_block* temp = (tid_block *)kmalloc(sizeof( tid_block ) , GFP_KERNEL);
+    temp->tid = tid;
+    temp->next_tid = NULL;
+    temp->prev_tid = NULL;
+    if(mblock->first_tid == NULL){
+        mblock->first_tid = temp;
+        mblock->last_tid = temp;
+    }
+    else{
+        mblock->last_tid->next_tid = temp;
+        temp->prev_tid = mblock->last_tid;
+        mblock->last_tid = temp;
+    }
+    return temp;    
+}
+
+int memory_remove(container_block* cblock, memory_block* mblock, tid_block* tblock){
+    if(tblock == NULL || (mblock->first_tid == tblock && mblock->last_tid == tblock)){     //only 1 tid (or nobody) using the memory
+        memory_tid_clear(mblock);
+        memory_unlink(cblock, mblock);
+        memory_put(mblock);         //pages stay alive until the last vma that maps them is gone
+        // printk("%d: Success remove tid and memory", current->pid);
+    }
+
+    else if(mblock->first_tid == tblock){       //tblock is the first tid block for the memory
+        mblock->first_tid = tblock->next_tid;
+        tblock->next_tid->prev_tid = NULL;
+        kfree(tblock);
+    }
+    else if(mblock->last_tid == tblock){        //tblock is the last tid block for the memory
+        mblock->last_tid = tblock->prev_tid;
+        tblock->prev_tid->next_tid = NULL;
+        kfree(tblock);
+    }
+    else{                                       //tblock is the middle block for the memory
+        tblock->prev_tid->next_tid = tblock->next_tid;
+        tblock->next_tid->prev_tid = tblock->prev_tid;
+        kfree(tblock);
+    }
+
+    // printk("%d: Success remove tid", current->pid);
+    return 0;
+}
+
+// container_access_ok: check whether the current task may hand objects to the tasks of cblock.
+// Allowed when every task in the container runs with the same effective uid as the caller, or the caller is CAP_SYS_ADMIN.
+int container_access_ok(container_block* cblock){
+    thread_block* temp = cblock->first_thread;
+    kuid_t euid = current_euid();
+    int ok = 1;
+
+    if(capable(CAP_SYS_ADMIN)){
+        return 1;
+    }
+    rcu_read_lock();
+    while(temp != NULL){
+        if(!uid_eq(task_euid(temp->task_info), euid)){
+            ok = 0;
+            break;
+        }
+        temp = temp->next_thread;
+    }
+    rcu_read_unlock();
+    return ok;
+}
+
+
+
+/**
+ * Deregister the task from the container.
+ * user_cmd does not contain useful information
+ * Need to use current to get the tid and search from it
+ */
 int resource_container_delete(struct resource_container_cmd __user *user_cmd)
 {
     struct resource_container_cmd cmd;
@@ -679,6 +1573,7 @@ int resource_container_delete(struct resource_container_cmd __user *user_cmd)
         return -1;
     }
 
+    trace_rcontainer_delete(temp_container->cid, target_tid);
     if(thread_remove(target_tid,temp_container) == -1){
         printk(KERN_ERR "error in removing thread\n");
         mutex_unlock(&mlock);
@@ -731,20 +1626,31 @@ int resource_container_create(struct resource_container_cmd __user *user_cmd)
     mutex_lock(&mlock);
     
 
-    // copy from write success, cmd contain the cid from the user
-    temp = search_container_create(cmd.cid);      //search does a container block exist already
-
-    if(temp == NULL){           //case when target container does not exist
-        temp = new_container_create(cmd.cid);
+    tblock = search_thread(current->pid);
+    if(tblock != NULL && tblock->cid != cmd.cid){      //already in another container, migrate moves it
+        mutex_unlock(&mlock);
+        return -EBUSY;
     }
+    if(tblock != NULL){         //registered in advance by RCONTAINER_IOCTL_REGISTER
+        temp = tblock->container;
+    }
+    else{
+        // copy from write success, cmd contain the cid from the user
+        temp = search_container_create(cmd.cid);      //search does a container block exist already
 
-    //Now temp has the pointer to the target continer, need to add the new thread to the container
-    tblock = new_thread_create(temp);
+        if(temp == NULL){           //case when target container does not exist
+            temp = new_container_create(cmd.cid);
+        }
+
+        //Now temp has the pointer to the target continer, need to add the new thread to the container
+        tblock = new_thread_create(temp);
+    }
+    trace_rcontainer_create(temp->cid, tblock->tid);
     //debug statement       
 
     mutex_unlock(&mlock);
 
-    if(temp->first_thread != tblock){
+    if(temp->running_thread != tblock){
         set_current_state(TASK_INTERRUPTIBLE);
         schedule();
     }
@@ -758,6 +1664,222 @@ int resource_container_create(struct resource_container_cmd __user *user_cmd)
     return 0;
 }
 
+// task_access_ok: check whether the current task may move task to a container
+// Allowed for tasks with the same effective uid as the caller, or when the caller is CAP_SYS_ADMIN.
+int task_access_ok(struct task_struct* task){
+    int ok;
+
+    if(task == current || capable(CAP_SYS_ADMIN)){
+        return 1;
+    }
+    rcu_read_lock();
+    ok = uid_eq(task_euid(task), current_euid());
+    rcu_read_unlock();
+    return ok;
+}
+
+/**
+ * Move a task (the caller when cmd.tid is 0) from its container to the container cmd.cid in one step.
+ * Unlike delete + create the thread block stays alive, with its turn and runtime accounting. Objects and locks
+ * belong to the source container and stay there; they are freed with it if the task was its last thread.
+ * Scheduling stays consistent on both sides: if the task had the turn in the source container the next thread
+ * gets it, and in the target container the task runs only if it is the first thread there. Otherwise the caller
+ * parks itself here, and another task that was moved parks at its next switch call.
+ */
+int resource_container_migrate(struct resource_container_migrate_cmd __user *user_cmd)
+{
+    struct resource_container_migrate_cmd cmd;
+    container_block* source;
+    container_block* target;
+    thread_block* tblock;
+    int tid, park, self;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    tid = (cmd.tid == 0) ? current->pid : cmd.tid;
+
+    mutex_lock(&mlock);
+    source = search_all_container_tid(tid);
+    if(source == NULL){
+        mutex_unlock(&mlock);
+        return -ESRCH;
+    }
+    tblock = search_thread(tid);
+    if(!task_access_ok(tblock->task_info)){
+        mutex_unlock(&mlock);
+        return -EPERM;
+    }
+    if(source->cid == cmd.cid){
+        mutex_unlock(&mlock);
+        return 0;
+    }
+
+    target = search_container_create(cmd.cid);
+    if(target == NULL){
+        target = new_container_create(cmd.cid);
+    }
+    thread_unlink(source, tblock);
+    thread_attach(target, tblock);
+    park = (target->first_thread != tblock);
+    self = (tblock->task_info == current);
+    if(source->first_thread == NULL){
+        container_destroy(source);
+    }
+
+    if(!park && !self){
+        wake_up_process(tblock->task_info);
+    }
+    mutex_unlock(&mlock);
+
+    if(park && self){
+        set_current_state(TASK_INTERRUPTIBLE);
+        schedule();
+    }
+    return 0;
+}
+
+/**
+ * Create (or update) many containers with their attributes under one hold of mlock, so a job can set up
+ * its whole fleet before any worker starts. Containers created here have no thread until tasks join them.
+ * With RCONTAINER_SETUP_REMOVE the listed containers are removed instead, with their objects and locks;
+ * it fails with -ENOENT for a container that does not exist and -EBUSY for one that still has threads.
+ * Every entry is checked before anything changes, a weight above RCONTAINER_WEIGHT_MAX fails with -EINVAL.
+ * return the number of containers set up or removed
+ */
+int resource_container_setup(struct resource_container_setup_cmd __user *user_cmd)
+{
+    struct resource_container_setup_cmd cmd;
+    struct resource_container_attr* attrs;
+    container_block* cblock;
+    int i, ret;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    if(cmd.count > RCONTAINER_SETUP_MAX){
+        return -E2BIG;
+    }
+    attrs = kvmalloc_array(cmd.count, sizeof(*attrs), GFP_KERNEL);
+    if(attrs == NULL){
+        return -ENOMEM;
+    }
+    if(copy_from_user(attrs, u64_to_user_ptr(cmd.attrs), cmd.count * sizeof(*attrs))){
+        kvfree(attrs);
+        return -EFAULT;
+    }
+
+    mutex_lock(&mlock);
+    for(i = 0; i < cmd.count; i++){
+        if(cmd.flags & RCONTAINER_SETUP_REMOVE){
+            cblock = search_container_create(attrs[i].cid);
+            ret = (cblock == NULL) ? -ENOENT : (cblock->first_thread != NULL) ? -EBUSY : 0;
+        }
+        else{
+            ret = (attrs[i].weight > RCONTAINER_WEIGHT_MAX) ? -EINVAL : 0;
+        }
+        if(ret){
+            mutex_unlock(&mlock);
+            kvfree(attrs);
+            return ret;
+        }
+    }
+    for(i = 0; i < cmd.count; i++){
+        cblock = search_container_create(attrs[i].cid);
+        if(cmd.flags & RCONTAINER_SETUP_REMOVE){
+            if(cblock != NULL){         //NULL when the cid was listed twice
+                container_destroy(cblock);
+            }
+            continue;
+        }
+        if(cblock == NULL){
+            cblock = new_container_create(attrs[i].cid);
+        }
+        if(attrs[i].weight != 0){
+            cblock->weight = attrs[i].weight;
+        }
+        cblock->timeslice_ns = attrs[i].timeslice_ns;
+        cblock->quota_ns = attrs[i].quota_ns;
+    }
+    mutex_unlock(&mlock);
+    kvfree(attrs);
+    return i;
+}
+
+/**
+ * Register other tasks (e.g. freshly forked workers) in containers on their behalf.
+ * A registered task joins its container without a list scan when it calls create with the same cid, and
+ * waits there for its turn. A task that exits without deleting itself is removed by the switch.
+ * Stops at the first task that does not exist (-ESRCH), is not the caller's to move (-EPERM) or is already
+ * in a container (-EBUSY).
+ * return the number of tasks registered, or the error of the first one if none was
+ */
+int resource_container_register(struct resource_container_register_cmd __user *user_cmd)
+{
+    struct resource_container_register_cmd cmd;
+    struct resource_container_task* tasks;
+    struct task_struct* task;
+    struct pid* pid;
+    container_block* cblock;
+    thread_block* tblock;
+    int i, ret = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    if(cmd.count > RCONTAINER_SETUP_MAX){
+        return -E2BIG;
+    }
+    tasks = kvmalloc_array(cmd.count, sizeof(*tasks), GFP_KERNEL);
+    if(tasks == NULL){
+        return -ENOMEM;
+    }
+    if(copy_from_user(tasks, u64_to_user_ptr(cmd.tasks), cmd.count * sizeof(*tasks))){
+        kvfree(tasks);
+        return -EFAULT;
+    }
+
+    mutex_lock(&mlock);
+    for(i = 0; i < cmd.count; i++){
+        pid = find_get_pid(tasks[i].pid);
+        task = (pid == NULL) ? NULL : get_pid_task(pid, PIDTYPE_PID);
+        put_pid(pid);
+        if(task == NULL){
+            ret = -ESRCH;
+            break;
+        }
+        if(!task_access_ok(task)){
+            put_task_struct(task);
+            ret = -EPERM;
+            break;
+        }
+        if(search_thread(task->pid) != NULL){
+            put_task_struct(task);
+            ret = -EBUSY;
+            break;
+        }
+        tblock = (thread_block *)kmalloc(sizeof( thread_block ) , GFP_KERNEL);
+        if(tblock == NULL){
+            put_task_struct(task);
+            ret = -ENOMEM;
+            break;
+        }
+        cblock = search_container_create(tasks[i].cid);
+        if(cblock == NULL){
+            cblock = new_container_create(tasks[i].cid);
+        }
+        tblock->task_info = task;       //the reference from get_pid_task is kept until the thread block is freed
+        tblock->tid = task->pid;
+        thread_attach(cblock, tblock);
+    }
+    mutex_unlock(&mlock);
+    kvfree(tasks);
+    return (i > 0) ? i : ret;
+}
+
 /**
  * Switch idea: Need to keep it simple. Each of the switch only apply to one container.
  *  If current selected container only has one thread, switch do nothing for the selected container.
@@ -777,217 +1899,2340 @@ int resource_container_switch(struct resource_container_cmd __user *user_cmd)
     struct resource_container_cmd cmd;
     container_block* cblock;
     thread_block* curr_tblock;
-    //debug statement
-    printk("%d: trying to perform switch", current->pid);  
+    thread_block* self;
     if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
     {
         return -1;
     }
 
-    mutex_lock(&mlock);
+    mutex_lock(&mlock);
+
+    cblock = switch_target_container;          //Obtain the continer that need to switch
+
+    //threads that exited without delete leave here, the container goes with its last one
+    if(cblock != NULL && container_reap(cblock)){
+        cblock = switch_target_container;
+    }
+    if(cblock == NULL){
+        printk( "No container exist");
+        mutex_unlock(&mlock); 
+        return 0;
+    }
+
+
+    //if there are more than 1 thread and the running one has used its timeslice
+    if(cblock->first_thread != cblock->last_thread &&
+       ktime_get_ns() - cblock->turn_start_ns >= cblock->timeslice_ns){
+
+            
+        curr_tblock = cblock->running_thread;
+        
+        if(cblock->running_thread == cblock->last_thread){      // if the current running thread is the last thread within the container
+            cblock->running_thread = cblock->first_thread;
+        }
+        else{
+            cblock->running_thread = cblock->running_thread->next_thread;
+        }
+
+        cblock->turn_start_ns = ktime_get_ns();
+        cblock->switches++;
+        thread_park(curr_tblock, cblock->turn_start_ns);
+        thread_unpark(cblock, cblock->running_thread, cblock->turn_start_ns);
+        trace_rcontainer_switch(cblock->cid, curr_tblock->tid, cblock->running_thread->tid);
+
+        wake_up_process(cblock->running_thread->task_info);
+        curr_tblock->task_info->state = (TASK_INTERRUPTIBLE);
+        
+
+    }        
+
+    //a container of weight n keeps the switch for n turns in a row
+    if(++cblock->turns >= cblock->weight){
+        cblock->turns = 0;
+        if(switch_target_container == last_container){
+            switch_target_container = first_container;
+        }
+        else{
+            switch_target_container = switch_target_container->next_container;
+        }
+    }
+
+    //a caller without the turn (e.g. moved into a busy container by another task) parks here
+    self = search_thread(current->pid);
+    if(self != NULL && self->container->running_thread != self){
+        set_current_state(TASK_INTERRUPTIBLE);
+    }
+    mutex_unlock(&mlock); 
+    schedule();
+    return 0;
+}
+// vma operations for object mappings: vm_private_data holds the memory block, and every vma keeps a reference
+// on it so the pages outlive a free or a transfer while they are still mapped somewhere.
+static void resource_container_vm_open(struct vm_area_struct *vma)
+{
+    memory_block* mblock = vma->vm_private_data;
+    atomic_inc(&mblock->refs);
+}
+
+static void resource_container_vm_close(struct vm_area_struct *vma)
+{
+    memory_put(vma->vm_private_data);
+}
+
+static vm_fault_t resource_container_vm_fault(struct vm_fault *vmf)
+{
+    memory_block* mblock = memory_backing(vmf->vma->vm_private_data);
+    unsigned long index = vmf->pgoff - vmf->vma->vm_pgoff;
+    struct page* page;
+
+    if(index >= mblock->nr_pages){
+        return VM_FAULT_SIGBUS;
+    }
+    trace_rcontainer_fault(mblock->oid, index, !!(vmf->flags & FAULT_FLAG_WRITE));
+    mutex_lock(&mblock->page_lock);
+    if(memory_populate(mblock, index)){
+        mutex_unlock(&mblock->page_lock);
+        return VM_FAULT_SIGBUS;
+    }
+    if((vmf->flags & FAULT_FLAG_WRITE) && memory_cow_break(mblock, index, vmf->vma->vm_file->f_mapping)){
+        mutex_unlock(&mblock->page_lock);
+        return VM_FAULT_OOM;
+    }
+    page = mblock->pages[index];
+    get_page(page);
+    mutex_unlock(&mblock->page_lock);
+    vmf->page = page;
+    return 0;
+}
+
+// resource_container_vm_mkwrite: a read-only pte is about to become writable.
+// If the page is still shared with a snapshot, or was replaced by a copy since it got mapped,
+// the pte is zapped and the fault retried so resource_container_vm_fault maps the private copy.
+static vm_fault_t resource_container_vm_mkwrite(struct vm_fault *vmf)
+{
+    memory_block* mblock = memory_backing(vmf->vma->vm_private_data);
+    struct address_space* mapping = vmf->vma->vm_file->f_mapping;
+    unsigned long index = vmf->pgoff - vmf->vma->vm_pgoff;
+
+    if(index >= mblock->nr_pages){
+        return VM_FAULT_SIGBUS;
+    }
+    mutex_lock(&mblock->page_lock);
+    if(mblock->cow != NULL && test_bit(index, mblock->cow)){
+        if(memory_cow_break(mblock, index, mapping)){
+            mutex_unlock(&mblock->page_lock);
+            return VM_FAULT_OOM;
+        }
+    }
+    if(mblock->pages[index] != vmf->page){
+        unmap_mapping_range(mapping, (loff_t)(mblock->oid + index) << PAGE_SHIFT, PAGE_SIZE, 1);
+        mutex_unlock(&mblock->page_lock);
+        return VM_FAULT_NOPAGE;
+    }
+    memory_mark_dirty(mblock, index);
+    lock_page(vmf->page);
+    mutex_unlock(&mblock->page_lock);
+    return VM_FAULT_LOCKED;
+}
+
+static const struct vm_operations_struct resource_container_vm_ops = {
+    .open           = resource_container_vm_open,
+    .close          = resource_container_vm_close,
+    .fault          = resource_container_vm_fault,
+    .page_mkwrite   = resource_container_vm_mkwrite,
+};
+
+// resource_container_mmap_file: map a persistent object by replacing the device file of vma with the backing file.
+// The file offset starts at 0 for the object, dirty tracking and writeback are done by the file system.
+int resource_container_mmap_file(struct vm_area_struct *vma, struct file* backing_file)
+{
+    struct file* device_file = vma->vm_file;
+    unsigned long pgoff = vma->vm_pgoff;
+    int ret;
+
+    if(!backing_file->f_op->mmap){
+        return -ENODEV;
+    }
+    get_file(backing_file);
+    vma->vm_file = backing_file;
+    vma->vm_pgoff = 0;
+    ret = backing_file->f_op->mmap(backing_file, vma);
+    if(ret){
+        vma->vm_file = device_file;
+        vma->vm_pgoff = pgoff;
+        fput(backing_file);
+        return ret;
+    }
+    fput(device_file);
+    return 0;
+}
+
+// resource_container_mmap_lock_page: map the lock page of cblock, it must be a single page
+int resource_container_mmap_lock_page(container_block* cblock, struct vm_area_struct *vma)
+{
+    if(vma->vm_end - vma->vm_start != PAGE_SIZE || cblock->lock_page == NULL){
+        return -EINVAL;
+    }
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+    return vm_insert_page(vma, vma->vm_start, cblock->lock_page);
+}
+
+// resource_container_mmap_ring: map the submission and completion rings of the fd
+int resource_container_mmap_ring(struct file *filp, struct vm_area_struct *vma)
+{
+    file_block* fblock = filp->private_data;
+    int ret;
+
+    mutex_lock(&fblock->ring_lock);
+    if(fblock->ring == NULL || vma->vm_end - vma->vm_start > fblock->ring_size){
+        mutex_unlock(&fblock->ring_lock);
+        return -EINVAL;
+    }
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+    ret = remap_vmalloc_range(vma, fblock->ring, 0);
+    mutex_unlock(&fblock->ring_lock);
+    return ret;
+}
+
+/**
+ * Allocates memory in kernal space for sharing with tasks in the same container and 
+ * maps the virtual address to the physical address.
+ * The pages are inserted lazily by resource_container_vm_fault instead of remap_pfn_range.
+ */
+static int resource_container_do_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    container_block* temp_container;
+    memory_block* temp_memory = NULL;
+    tid_block* tblock;
+    struct file* backing_file;
+    int ret, created;
+
+    //debug statement
+    // printk("%d: resource_container_mmap start\n", current->pid); 
+
+    //the rings belong to the fd, not to a container
+    if(vma->vm_pgoff == RCONTAINER_RING_OFFSET){
+        return resource_container_mmap_ring(filp, vma);
+    }
+
+    mutex_lock(&mlock);
+
+    temp_container = search_all_container_tid(current->pid);
+
+    if(temp_container == NULL){
+        printk(KERN_ERR "container not found with pid: %d", current->pid);
+        mutex_unlock(&mlock);
+        return -EINVAL;
+    }
+
+    //offsets from RCONTAINER_RESERVED_OFFSET on are not objects
+    if(vma->vm_pgoff >= RCONTAINER_RESERVED_OFFSET){
+        ret = (vma->vm_pgoff == RCONTAINER_LOCK_PAGE_OFFSET) ? resource_container_mmap_lock_page(temp_container, vma) : -EINVAL;
+        mutex_unlock(&mlock);
+        return ret;
+    }
+
+    temp_memory = search_memory(temp_container, vma->vm_pgoff);
+    created = (temp_memory == NULL);
+
+    if(temp_memory == NULL){
+        // printk("    %d: Need to allocate new memory", current->pid);
+        temp_memory = new_memory_create(temp_container, vma->vm_pgoff, vma->vm_end - vma->vm_start);
+        if(temp_memory == NULL){
+            printk(KERN_ERR "Wrong with allocating data");
+            mutex_unlock(&mlock);
+            return -ENOMEM;
+        }
+    }
+    trace_rcontainer_mmap(temp_container->cid, temp_memory->oid, vma->vm_end - vma->vm_start, created);
+
+    if(temp_memory->readonly){
+        if(vma->vm_flags & VM_WRITE){
+            mutex_unlock(&mlock);
+            return -EACCES;
+        }
+        vma->vm_flags &= ~VM_MAYWRITE;
+    }
+
+    tblock = search_memory_tid(temp_memory, current->pid);
+
+    //search is the tid that use current allocate memory recorded. Use for free the memory when all thread called free
+    if(tblock == NULL){
+        tblock = new_memory_tid_create(temp_memory, current->pid);
+    }
+
+    //persistent object: hand the vma over to the backing file so its page cache is mapped directly
+    backing_file = memory_backing(temp_memory)->backing_file;
+    if(backing_file != NULL){
+        ret = resource_container_mmap_file(vma, backing_file);
+        mutex_unlock(&mlock);
+        return ret;
+    }
+
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+    vma->vm_ops = &resource_container_vm_ops;
+    vma->vm_private_data = temp_memory;
+    atomic_inc(&temp_memory->refs);          //vm_ops->open is not called for the first vma
+
+    // printk("The vma page offset value is: %lu", vma->vm_pgoff);
+
+    //debug statement
+    // printk("resource_container_mmap end\n");
+    mutex_unlock(&mlock); 
+    // printk("%d: resource_container_mmap after lock\n", current->pid); 
+    return 0;
+
+}
+
+int resource_container_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    u64 start = ktime_get_ns();
+    int ret = resource_container_do_mmap(filp, vma);
+
+    latency_record(RCONTAINER_LAT_MMAP, ktime_get_ns() - start);
+    return ret;
+}
+
+// file_disarm: forget the nonblocking wait armed on fblock
+void file_disarm(file_block* fblock){
+    memory_block* mblock;
+
+    spin_lock(&fblock->lock);
+    mblock = fblock->armed;
+    fblock->armed = NULL;
+    spin_unlock(&fblock->lock);
+    if(mblock != NULL){
+        memory_put(mblock);
+    }
+}
+
+/**
+ * open the device: every open gets its own file block for the state of its nonblocking waits.
+ */
+int resource_container_open(struct inode *inode, struct file *filp)
+{
+    file_block* fblock = (file_block *)kmalloc(sizeof( file_block ), GFP_KERNEL);
+
+    if(fblock == NULL){
+        return -ENOMEM;
+    }
+    spin_lock_init(&fblock->lock);
+    fblock->armed = NULL;
+    fblock->armed_version = 0;
+    fblock->polled = NULL;
+    fblock->selected = NULL;
+    mutex_init(&fblock->ring_lock);
+    fblock->ring = NULL;
+    fblock->ring_size = 0;
+    fblock->ring_entries = 0;
+    fblock->sq_head = 0;
+    fblock->cq_tail = 0;
+    fblock->cq_pending = 0;
+    filp->private_data = fblock;
+    return 0;
+}
+
+int resource_container_release(struct inode *inode, struct file *filp)
+{
+    file_block* fblock = filp->private_data;
+    poll_block* pblock;
+
+    file_disarm(fblock);
+    //epoll has removed its entries by now, so the waitqueues may go
+    while(fblock->polled != NULL){
+        pblock = fblock->polled;
+        fblock->polled = pblock->next;
+        memory_put(pblock->mblock);
+        kfree(pblock);
+    }
+    if(fblock->selected != NULL){
+        memory_put(fblock->selected);
+    }
+    vfree(fblock->ring);                //the mappings of the ring hold the file, so they are gone by now
+    kfree(fblock);
+    return 0;
+}
+
+// file_poll_register: keep a reference on mblock for as long as the fd lives, poll is about to wait on its queue.
+// Takes over the caller's reference. return 0, or -ENOMEM
+int file_poll_register(file_block* fblock, memory_block* mblock){
+    poll_block* pblock;
+
+    spin_lock(&fblock->lock);
+    for(pblock = fblock->polled; pblock != NULL && pblock->mblock != mblock; pblock = pblock->next);
+    spin_unlock(&fblock->lock);
+    if(pblock != NULL){
+        memory_put(mblock);
+        return 0;
+    }
+    pblock = (poll_block *)kmalloc(sizeof( poll_block ), GFP_KERNEL);
+    if(pblock == NULL){
+        memory_put(mblock);
+        return -ENOMEM;
+    }
+    pblock->mblock = mblock;
+    spin_lock(&fblock->lock);
+    pblock->next = fblock->polled;
+    fblock->polled = pblock;
+    spin_unlock(&fblock->lock);
+    return 0;
+}
+
+/**
+ * poll the device: readable once the object the fd is armed on has been notified.
+ * The fd waits on the notify_wait of that object, so a notify only wakes the pollers of its own object.
+ * poll() and select() follow the object armed at each call; epoll registers on the object armed when the fd is
+ * added, so an fd armed on another object afterwards has to be added again.
+ */
+__poll_t resource_container_poll(struct file *filp, poll_table *wait)
+{
+    file_block* fblock = filp->private_data;
+    memory_block* mblock;
+    __poll_t mask = 0;
+
+    spin_lock(&fblock->lock);
+    mblock = fblock->armed;
+    if(mblock != NULL){
+        atomic_inc(&mblock->refs);
+        if((u32)atomic_read(&memory_backing(mblock)->version) != fblock->armed_version){
+            mask = EPOLLIN | EPOLLRDNORM;
+        }
+    }
+    spin_unlock(&fblock->lock);
+
+    if(mblock == NULL){
+        return 0;
+    }
+    if(poll_does_not_wait(wait)){
+        memory_put(mblock);
+        return mask;
+    }
+    poll_wait(filp, &memory_backing(mblock)->notify_wait, wait);
+    if(file_poll_register(fblock, mblock)){
+        return EPOLLERR;
+    }
+    return mask;
+}
+
+// file_selected: the object selected on the fd, with a reference the caller drops with memory_put
+memory_block* file_selected(file_block* fblock){
+    memory_block* mblock;
+
+    spin_lock(&fblock->lock);
+    mblock = fblock->selected;
+    if(mblock != NULL){
+        atomic_inc(&mblock->refs);
+    }
+    spin_unlock(&fblock->lock);
+    return mblock;
+}
+
+// file_transfer: copy between iter and the selected object from iocb->ki_pos on, a page at a time, without
+// mapping the object in user space. Stops at the end of the object.
+// return the number of bytes copied, or a negative error if nothing was
+ssize_t file_transfer(struct kiocb *iocb, struct iov_iter *iter, int write){
+    file_block* fblock = iocb->ki_filp->private_data;
+    memory_block* mblock = file_selected(fblock);
+    struct page* page;
+    loff_t size;
+    size_t offset, len, copied;
+    ssize_t done = 0;
+
+    if(mblock == NULL){
+        return -EBADFD;
+    }
+    size = (loff_t)memory_backing(mblock)->nr_pages << PAGE_SHIFT;
+    if(write && iocb->ki_pos >= size && iov_iter_count(iter)){
+        memory_put(mblock);
+        return -ENOSPC;
+    }
+
+    while(iov_iter_count(iter) && iocb->ki_pos < size){
+        page = memory_get_page(mblock, iocb->ki_pos >> PAGE_SHIFT, write, iocb->ki_filp->f_mapping);
+        if(IS_ERR(page)){
+            if(done == 0){
+                done = PTR_ERR(page);
+            }
+            break;
+        }
+        offset = offset_in_page(iocb->ki_pos);
+        len = min_t(loff_t, PAGE_SIZE - offset, size - iocb->ki_pos);
+        if(write){
+            copied = copy_page_from_iter(page, offset, len, iter);
+            if(copied && memory_backing(mblock)->backing_file != NULL){
+                set_page_dirty_lock(page);
+            }
+        }
+        else{
+            copied = copy_page_to_iter(page, offset, len, iter);
+        }
+        put_page(page);
+        iocb->ki_pos += copied;
+        done += copied;
+        if(copied < len){
+            if(done == 0){
+                done = -EFAULT;
+            }
+            break;
+        }
+    }
+    memory_put(mblock);
+    return done;
+}
+
+ssize_t resource_container_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    return file_transfer(iocb, to, 0);
+}
+
+ssize_t resource_container_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    return file_transfer(iocb, from, 1);
+}
+
+/**
+ * seek within the selected object, SEEK_END is relative to its size.
+ */
+loff_t resource_container_llseek(struct file *filp, loff_t offset, int whence)
+{
+    memory_block* mblock = file_selected(filp->private_data);
+    loff_t size;
+
+    if(mblock == NULL){
+        return -EBADFD;
+    }
+    size = (loff_t)memory_backing(mblock)->nr_pages << PAGE_SHIFT;
+    memory_put(mblock);
+    return fixed_size_llseek(filp, offset, whence, size);
+}
+
+/**
+ * Hand an object of the container registered by the current task to the container cmd.cid without copying.
+ * cmd.op selects the mode:
+ *  RCONTAINER_TRANSFER_MOVE: the memory block (and its pages) moves to the target container, the source loses the oid.
+ *  RCONTAINER_TRANSFER_SHARE: the target container gets a read-only object with the same oid on the same pages.
+ * Mappings that already exist in the source container stay valid until they are unmapped.
+ */
+int resource_container_transfer(struct resource_container_cmd __user *user_cmd)
+{
+    struct resource_container_cmd cmd;
+    container_block* src_container;
+    container_block* dst_container;
+    memory_block* mblock;
+    int ret = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        printk(KERN_ERR "copy from user function fail from resource container transfer\n");
+        return -EFAULT;
+    }
+
+    if(cmd.op != RCONTAINER_TRANSFER_MOVE && cmd.op != RCONTAINER_TRANSFER_SHARE){
+        return -EINVAL;
+    }
+
+    mutex_lock(&mlock);
+
+    src_container = search_all_container_tid(current->pid);
+    dst_container = search_container_create(cmd.cid);
+    if(src_container == NULL || dst_container == NULL){
+        ret = -ENOENT;
+        goto out;
+    }
+    if(src_container == dst_container){
+        ret = -EINVAL;
+        goto out;
+    }
+
+    mblock = search_memory(src_container, cmd.oid);
+    if(mblock == NULL){
+        ret = -ENOENT;
+        goto out;
+    }
+    if(search_memory(dst_container, cmd.oid) != NULL){
+        ret = -EEXIST;
+        goto out;
+    }
+    if(!container_access_ok(dst_container)){
+        ret = -EPERM;
+        goto out;
+    }
+
+    if(cmd.op == RCONTAINER_TRANSFER_MOVE){
+        //the tids recorded belong to the source container, the target container starts with no user
+        memory_unlink(src_container, mblock);
+        memory_tid_clear(mblock);
+        memory_link(dst_container, mblock);
+    }
+    else if(memory_share_create(dst_container, mblock) == NULL){
+        ret = -ENOMEM;
+    }
+
+out:
+    mutex_unlock(&mlock);
+    return ret;
+}
+
+/**
+ * Create the object cmd.snapshot_oid as a point-in-time copy of the object cmd.oid without stopping writers.
+ * Both objects share every page copy-on-write; the first write to a page from either side gives that side its own copy.
+ */
+int resource_container_snapshot(struct file *filp, struct resource_container_snapshot_cmd __user *user_cmd)
+{
+    struct resource_container_snapshot_cmd cmd;
+    container_block* cblock;
+    memory_block* mblock;
+    int ret = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        printk(KERN_ERR "copy from user function fail from resource container snapshot\n");
+        return -EFAULT;
+    }
+
+    mutex_lock(&mlock);
+
+    cblock = search_all_container_tid(current->pid);
+    mblock = (cblock == NULL) ? NULL : search_memory(cblock, cmd.oid);
+    if(mblock == NULL){
+        ret = -ENOENT;
+        goto out;
+    }
+    if(search_memory(cblock, cmd.snapshot_oid) != NULL){
+        ret = -EEXIST;
+        goto out;
+    }
+    if(memory_snapshot_create(cblock, mblock, cmd.snapshot_oid) == NULL){
+        ret = -ENOMEM;
+        goto out;
+    }
+    //writable ptes of the source would bypass the copy-on-write, make every mapping fault again
+    mblock = memory_backing(mblock);
+    unmap_mapping_range(filp->f_mapping, (loff_t)mblock->oid << PAGE_SHIFT, (loff_t)mblock->nr_pages << PAGE_SHIFT, 1);
+
+out:
+    mutex_unlock(&mlock);
+    return ret;
+}
+
+/**
+ * Create or reattach the persistent object cmd.oid in the container registered by the current task.
+ * The data lives in the page cache of <persist_dir>/<uid>.<cid>.<oid>, so it survives a module reload or a process restart.
+ * persist_dir has to be on tmpfs, a file on any other file system fails with -EOPNOTSUPP. The objects are a warm
+ * start only: nothing is written to disk, they are gone after a reboot or a crash.
+ */
+int resource_container_attach(struct resource_container_attach_cmd __user *user_cmd)
+{
+    struct resource_container_attach_cmd cmd;
+    container_block* cblock;
+    memory_block* mblock;
+    int ret = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        printk(KERN_ERR "copy from user function fail from resource container attach\n");
+        return -EFAULT;
+    }
+
+    mutex_lock(&mlock);
+
+    cblock = search_all_container_tid(current->pid);
+    if(cblock == NULL){
+        ret = -EINVAL;
+        goto out;
+    }
+    if(search_memory(cblock, cmd.oid) != NULL){
+        ret = -EEXIST;
+        goto out;
+    }
+    mblock = persistent_memory_create(cblock, cmd.oid, cmd.size, cmd.flags & RCONTAINER_ATTACH_CREATE);
+    if(IS_ERR(mblock)){
+        ret = PTR_ERR(mblock);
+    }
+
+out:
+    mutex_unlock(&mlock);
+    return ret;
+}
+
+// checkpoint_write: append len bytes of buf to the checkpoint stream
+// return 0 on success, or a negative error
+int checkpoint_write(struct file* file, const void* buf, size_t len, loff_t* pos){
+    ssize_t ret = kernel_write(file, buf, len, pos);
+
+    if(ret < 0){
+        return ret;
+    }
+    return (ret == len) ? 0 : -EIO;
+}
+
+// checkpoint_page_wanted: whether page index of mblock goes into the checkpoint.
+// dirty is the tracking bitmap of the previous checkpoint, NULL to take every non-zero page.
+// A dirty page is taken even when it is zero now, so an incremental restore does not keep stale data.
+int checkpoint_page_wanted(memory_block* mblock, unsigned long index, unsigned long* dirty){
+    struct page* page;
+    void* address;
+    int nonzero;
+
+    if(dirty != NULL){
+        return test_bit(index, dirty);
+    }
+    mutex_lock(&mblock->page_lock);
+    page = mblock->pages[index];
+    if(page == NULL){       //not restored yet, it is only worth reading if the old checkpoint had data for it
+        nonzero = (mblock->restore_pos != NULL && mblock->restore_pos[index] >= 0);
+    }
+    else{
+        address = kmap_atomic(page);
+        nonzero = (memchr_inv(address, 0, PAGE_SIZE) != NULL);
+        kunmap_atomic(address);
+    }
+    mutex_unlock(&mblock->page_lock);
+    return nonzero;
+}
+
+// checkpoint_object: write the record, extents and pages of one object.
+// Dirty tracking is re-armed first: a fresh bitmap is installed and the mappings are zapped, so every
+// write from here on faults through page_mkwrite and lands in the next incremental checkpoint.
+// return 0 on success, or a negative error
+int checkpoint_object(struct file* file, loff_t* pos, memory_block* mblock, int incremental, struct address_space* mapping){
+    struct resource_container_checkpoint_object record;
+    struct resource_container_checkpoint_extent extent;
+    unsigned long* tracking = bitmap_zalloc(mblock->nr_pages, GFP_KERNEL);
+    unsigned long* dirty;
+    unsigned long i, j;
+    struct page* page;
+    void* address;
+    int ret = 0;
+
+    if(tracking == NULL){
+        return -ENOMEM;
+    }
+    mutex_lock(&mblock->page_lock);
+    dirty = mblock->dirty;
+    mblock->dirty = tracking;
+    mutex_unlock(&mblock->page_lock);
+    unmap_mapping_range(mapping, (loff_t)mblock->oid << PAGE_SHIFT, (loff_t)mblock->nr_pages << PAGE_SHIFT, 1);
+    if(!incremental){
+        bitmap_free(dirty);
+        dirty = NULL;
+    }
+
+    record.oid = mblock->oid;
+    record.nr_pages = mblock->nr_pages;
+    ret = checkpoint_write(file, &record, sizeof(record), pos);
+
+    for(i = 0; ret == 0 && i < mblock->nr_pages; i = j){
+        if(!checkpoint_page_wanted(mblock, i, dirty)){
+            j = i + 1;
+            continue;
+        }
+        for(j = i + 1; j < mblock->nr_pages && checkpoint_page_wanted(mblock, j, dirty); j++);
+        extent.first_page = i;
+        extent.nr_pages = j - i;
+        ret = checkpoint_write(file, &extent, sizeof(extent), pos);
+        for(; ret == 0 && i < j; i++){
+            mutex_lock(&mblock->page_lock);
+            ret = memory_populate(mblock, i);
+            page = mblock->pages[i];
+            if(ret == 0){
+                get_page(page);
+            }
+            mutex_unlock(&mblock->page_lock);
+            if(ret){
+                break;
+            }
+            address = kmap(page);
+            ret = checkpoint_write(file, address, PAGE_SIZE, pos);
+            kunmap(page);
+            put_page(page);
+        }
+    }
+    if(ret == 0){
+        extent.first_page = 0;
+        extent.nr_pages = 0;
+        ret = checkpoint_write(file, &extent, sizeof(extent), pos);
+    }
+    bitmap_free(dirty);
+    return ret;
+}
+
+/**
+ * Stream the objects of the container registered by the current task to the file cmd.fd.
+ * Read-only shares and persistent objects are left out, their data lives in another container or in a file.
+ * With RCONTAINER_CHECKPOINT_INCREMENTAL only pages written since the previous checkpoint are streamed
+ * (all non-zero pages of an object that was never checkpointed).
+ * For a consistent image, hold the object locks or stop the writers. cmd.fd has to be open for writing (-EBADF).
+ * return the number of objects written
+ */
+int resource_container_checkpoint(struct file *filp, struct resource_container_checkpoint_cmd __user *user_cmd)
+{
+    struct resource_container_checkpoint_cmd cmd;
+    struct resource_container_checkpoint_header header;
+    container_block* cblock;
+    memory_block* mblock;
+    memory_block** mblocks = NULL;
+    struct file* file;
+    unsigned long count = 0, i;
+    loff_t pos, start;
+    int ret = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    file = fget(cmd.fd);
+    if(file == NULL){
+        return -EBADF;
+    }
+    if(!(file->f_mode & FMODE_WRITE)){
+        fput(file);
+        return -EBADF;
+    }
+
+    //take a reference on every object so the stream is written without holding mlock
+    mutex_lock(&mlock);
+    cblock = search_all_container_tid(current->pid);
+    if(cblock == NULL){
+        ret = -EINVAL;
+    }
+    else{
+        for(mblock = cblock->first_memory; mblock != NULL; mblock = mblock->next_memory){
+            count++;
+        }
+        mblocks = kvmalloc_array(count, sizeof(*mblocks), GFP_KERNEL);
+        if(count && mblocks == NULL){
+            ret = -ENOMEM;
+        }
+        count = 0;
+        for(mblock = cblock->first_memory; ret == 0 && mblock != NULL; mblock = mblock->next_memory){
+            if(mblock->origin == NULL && mblock->backing_file == NULL){
+                atomic_inc(&mblock->refs);
+                mblocks[count++] = mblock;
+            }
+        }
+        header.cid = cblock->cid;
+    }
+    mutex_unlock(&mlock);
+
+    if(ret == 0){
+        header.magic = RCONTAINER_CHECKPOINT_MAGIC;
+        header.version = RCONTAINER_CHECKPOINT_VERSION;
+        header.page_size = PAGE_SIZE;
+        header.flags = cmd.flags & RCONTAINER_CHECKPOINT_INCREMENTAL;
+        header.reserved = 0;
+        header.nr_objects = count;
+        start = pos = file->f_pos;
+        ret = checkpoint_write(file, &header, sizeof(header), &pos);
+        for(i = 0; ret == 0 && i < count; i++){
+            ret = checkpoint_object(file, &pos, mblocks[i], header.flags, filp->f_mapping);
+        }
+        file->f_pos = pos;
+        cmd.bytes = pos - start;
+    }
+    for(i = 0; i < count; i++){
+        memory_put(mblocks[i]);
+    }
+    kvfree(mblocks);
+    fput(file);
+
+    if(ret){
+        return ret;
+    }
+    if(put_user(cmd.bytes, &user_cmd->bytes)){
+        return -EFAULT;
+    }
+    return count;
+}
+
+// checkpoint_read: read len bytes of the checkpoint stream into buf
+// return 0 on success, or a negative error
+int checkpoint_read(struct file* file, void* buf, size_t len, loff_t* pos){
+    ssize_t ret = kernel_read(file, buf, len, pos);
+
+    if(ret < 0){
+        return ret;
+    }
+    return (ret == len) ? 0 : -EIO;
+}
+
+// restore_object_lazy: create an object from its checkpoint record without reading its pages.
+// The offsets of the pages in the stream are recorded and the pages are read on first use.
+// return the new (unlinked) memory block, or an ERR_PTR
+memory_block* restore_object_lazy(struct file* file, loff_t* pos, struct resource_container_checkpoint_object* record){
+    struct resource_container_checkpoint_extent extent;
+    memory_block* mblock = memory_block_alloc(record->oid, record->nr_pages);
+    unsigned long i;
+    int ret = 0;
+
+    if(mblock == NULL){
+        return ERR_PTR(-ENOMEM);
+    }
+    mblock->restore_pos = kvmalloc_array(record->nr_pages, sizeof(loff_t), GFP_KERNEL);
+    if(mblock->restore_pos == NULL){
+        memory_put(mblock);
+        return ERR_PTR(-ENOMEM);
+    }
+    for(i = 0; i < record->nr_pages; i++){
+        mblock->restore_pos[i] = -1;
+    }
+    mblock->restore_file = get_file(file);
+
+    while((ret = checkpoint_read(file, &extent, sizeof(extent), pos)) == 0 && extent.nr_pages != 0){
+        if(extent.first_page >= record->nr_pages || extent.nr_pages > record->nr_pages - extent.first_page){
+            ret = -EINVAL;
+            break;
+        }
+        for(i = 0; i < extent.nr_pages; i++){
+            mblock->restore_pos[extent.first_page + i] = *pos + (i << PAGE_SHIFT);
+        }
+        *pos += extent.nr_pages << PAGE_SHIFT;
+    }
+    if(ret){
+        memory_put(mblock);
+        return ERR_PTR(ret);
+    }
+    return mblock;
+}
+
+// restore_object_apply: read the extents of a checkpoint record into the existing object mblock
+// return 0 on success, or a negative error
+int restore_object_apply(struct file* file, loff_t* pos, memory_block* mblock, struct address_space* mapping){
+    struct resource_container_checkpoint_extent extent;
+    struct page* page;
+    void* address;
+    unsigned long i;
+    int ret;
+
+    while((ret = checkpoint_read(file, &extent, sizeof(extent), pos)) == 0 && extent.nr_pages != 0){
+        for(i = 0; ret == 0 && i < extent.nr_pages; i++){
+            page = memory_get_page(mblock, extent.first_page + i, 1, mapping);
+            if(IS_ERR(page)){
+                return PTR_ERR(page);
+            }
+            address = kmap(page);
+            ret = checkpoint_read(file, address, PAGE_SIZE, pos);
+            kunmap(page);
+            put_page(page);
+        }
+        if(ret){
+            break;
+        }
+    }
+    return ret;
+}
+
+/**
+ * Restore a checkpoint stream from the file cmd.fd into the container registered by the current task.
+ * Objects the container does not have are recreated lazily: their pages are read from the file when they
+ * are first touched, so the file must stay as it is while they live. Objects the container has are
+ * updated in place, which applies an incremental checkpoint on top of a restored full one; a share or a
+ * persistent object with the oid of a record fails with -EINVAL. cmd.fd has to be open for reading (-EBADF).
+ * return the number of objects restored
+ */
+int resource_container_restore(struct file *filp, struct resource_container_checkpoint_cmd __user *user_cmd)
+{
+    struct resource_container_checkpoint_cmd cmd;
+    struct resource_container_checkpoint_header header;
+    struct resource_container_checkpoint_object record;
+    container_block* cblock;
+    memory_block* mblock;
+    struct file* file;
+    unsigned long i;
+    loff_t pos, start;
+    int ret;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    file = fget(cmd.fd);
+    if(file == NULL){
+        return -EBADF;
+    }
+    if(!(file->f_mode & FMODE_READ)){
+        fput(file);
+        return -EBADF;
+    }
+    if(!(file->f_mode & FMODE_PREAD)){     //lazy pages are read back at their offsets later
+        fput(file);
+        return -ESPIPE;
+    }
+
+    start = pos = file->f_pos;
+    ret = checkpoint_read(file, &header, sizeof(header), &pos);
+    if(ret == 0 && (header.magic != RCONTAINER_CHECKPOINT_MAGIC || header.version != RCONTAINER_CHECKPOINT_VERSION ||
+                    header.page_size != PAGE_SIZE)){
+        ret = -EINVAL;
+    }
+
+    for(i = 0; ret == 0 && i < header.nr_objects; i++){
+        ret = checkpoint_read(file, &record, sizeof(record), &pos);
+        if(ret){
+            break;
+        }
+        //oids are page offsets of the mmap space, an object has to end below the reserved offsets
+        if(record.oid >= RCONTAINER_RESERVED_OFFSET || record.nr_pages == 0 ||
+           record.nr_pages > RCONTAINER_RESERVED_OFFSET - record.oid){
+            ret = -EINVAL;
+            break;
+        }
+        mutex_lock(&mlock);
+        cblock = search_all_container_tid(current->pid);
+        mblock = (cblock == NULL) ? NULL : search_memory(cblock, record.oid);
+        if(mblock != NULL){
+            atomic_inc(&mblock->refs);
+        }
+        mutex_unlock(&mlock);
+        if(cblock == NULL){
+            ret = -EINVAL;
+            break;
+        }
+
+        if(mblock != NULL){
+            //shares and persistent objects are not in a checkpoint, their data belongs to another container or a file
+            ret = (mblock->origin == NULL && mblock->backing_file == NULL && mblock->nr_pages == record.nr_pages) ?
+                  restore_object_apply(file, &pos, mblock, filp->f_mapping) : -EINVAL;
+            memory_put(mblock);
+            continue;
+        }
+
+        mblock = restore_object_lazy(file, &pos, &record);
+        if(IS_ERR(mblock)){
+            ret = PTR_ERR(mblock);
+            break;
+        }
+        //the object only becomes visible once every page offset is known
+        mutex_lock(&mlock);
+        cblock = search_all_container_tid(current->pid);
+        if(cblock == NULL || search_memory(cblock, record.oid) != NULL){
+            ret = (cblock == NULL) ? -EINVAL : -EEXIST;
+            mutex_unlock(&mlock);
+            memory_put(mblock);
+            break;
+        }
+        memory_link(cblock, mblock);
+        mutex_unlock(&mlock);
+    }
+    file->f_pos = pos;
+    fput(file);
+
+    if(ret){
+        return ret;
+    }
+    if(put_user((__u64)(pos - start), &user_cmd->bytes)){
+        return -EFAULT;
+    }
+    return i;
+}
+
+/**
+ * lock the container that is register by the current task.
+ * This is the slow path: the library takes an uncontended lock with a compare-and-swap on the lock page
+ * and only calls in here when the word is already held.
+ */
+int resource_container_lock(struct resource_container_cmd __user *user_cmd)
+{
+    struct resource_container_cmd cmd;
+    lock_block* lblock;
+    int ret;
+    //debug statement
+    // printk("resource_container_lock start\n"); 
+    
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -1;
+    }
+
+    lblock = lock_lookup(cmd.oid);
+    if(lblock == NULL){
+        return -EINVAL;
+    }
+
+    ret = lock_wait(lblock, 0);
+    lock_put(lblock);
+    //debug statement
+    // printk("resource_container_lock end\n"); 
+    return ret;
+}
+
+/**
+ * take the lock of an object shared with other readers.
+ * Slow path of rcontainer_rdlock, exclusive lockers that are already waiting go first.
+ */
+int resource_container_rdlock(struct resource_container_cmd __user *user_cmd)
+{
+    struct resource_container_cmd cmd;
+    lock_block* lblock;
+    int ret;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    lblock = lock_lookup(cmd.oid);
+    if(lblock == NULL){
+        return -EINVAL;
+    }
+
+    ret = lock_wait(lblock, 1);
+    lock_put(lblock);
+    return ret;
+}
+
+/**
+ * take the lock of an object only if it is free right now.
+ * return -EAGAIN if the lock is busy
+ */
+int resource_container_trylock(struct resource_container_lock_cmd __user *user_cmd)
+{
+    struct resource_container_lock_cmd cmd;
+    lock_block* lblock;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    lblock = lock_lookup(cmd.oid);
+    if(lblock == NULL){
+        return -EINVAL;
+    }
+
+    if(!lock_word_trylock(lblock, cmd.flags & RCONTAINER_LOCK_SHARED)){
+        lock_put(lblock);
+        return -EAGAIN;
+    }
+    lock_stat_acquired(lblock, cmd.flags & RCONTAINER_LOCK_SHARED, 0);
+    lock_put(lblock);
+    return 0;
+}
+
+/**
+ * take the lock of an object, waiting at most cmd.timeout_ns nanoseconds.
+ * The wait is interruptible, return -ETIMEDOUT when the time is up and -EINTR on a signal.
+ * The waiter bits set while waiting are cleared by the next release.
+ */
+int resource_container_timedlock(struct resource_container_lock_cmd __user *user_cmd)
+{
+    struct resource_container_lock_cmd cmd;
+    lock_block* lblock;
+    int shared;
+    long ret;
+    u64 start;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    lblock = lock_lookup(cmd.oid);
+    if(lblock == NULL){
+        return -EINVAL;
+    }
+
+    shared = cmd.flags & RCONTAINER_LOCK_SHARED;
+    if(lock_word_trylock(lblock, shared)){
+        lock_stat_acquired(lblock, shared, 0);
+        lock_put(lblock);
+        return 0;
+    }
+    start = ktime_get_ns();
+    ret = wait_event_interruptible_hrtimeout(lblock->wait, lock_word_acquire(lblock, shared),
+                                             ns_to_ktime(min_t(u64, cmd.timeout_ns, KTIME_MAX)));
+    if(ret == 0){
+        lock_stat_acquired(lblock, shared, max_t(u64, ktime_get_ns() - start, 1));
+    }
+    lock_put(lblock);
+    if(ret == -ETIME){
+        return -ETIMEDOUT;
+    }
+    if(ret){
+        return -EINTR;
+    }
+    return 0;
+}
+
+static int oid_compare(const void* a, const void* b)
+{
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+// multilock_prepare: copy the oids of cmd from user space, sort them into the canonical (ascending) order,
+// drop duplicates and look up their lock blocks.
+// return the number of distinct locks, or a negative error; *lblocks_out must be freed by the caller on success
+int multilock_prepare(struct resource_container_multilock_cmd* cmd, lock_block*** lblocks_out){
+    lock_block** lblocks;
+    u64* oids;
+    int i, count = 0, ret;
+
+    if(cmd->count == 0){
+        return 0;
+    }
+    if(cmd->count > RCONTAINER_MULTILOCK_MAX){
+        return -E2BIG;
+    }
+    oids = kmalloc_array(cmd->count, sizeof(u64), GFP_KERNEL);
+    lblocks = kmalloc_array(cmd->count, sizeof(lock_block *), GFP_KERNEL);
+    if(oids == NULL || lblocks == NULL){
+        ret = -ENOMEM;
+        goto fail;
+    }
+    if(copy_from_user(oids, u64_to_user_ptr(cmd->oids), cmd->count * sizeof(u64))){
+        ret = -EFAULT;
+        goto fail;
+    }
+
+    sort(oids, cmd->count, sizeof(u64), oid_compare, NULL);
+    for(i = 0; i < cmd->count; i++){
+        if(count == 0 || oids[count - 1] != oids[i]){
+            oids[count++] = oids[i];
+        }
+    }
+
+    ret = lock_lookup_many(oids, count, lblocks);
+    if(ret){
+        goto fail;
+    }
+    kfree(oids);
+    *lblocks_out = lblocks;
+    return count;
+
+fail:
+    kfree(oids);
+    kfree(lblocks);
+    return ret;
+}
+
+/**
+ * take the locks of several objects of the container in one call, all or nothing.
+ * The locks are taken in ascending oid order, so callers that lock through here cannot deadlock each other.
+ * With RCONTAINER_LOCK_TRY the call fails with -EAGAIN as soon as one lock is busy, otherwise it waits (killable).
+ * On failure no lock is held.
+ */
+int resource_container_multilock(struct resource_container_multilock_cmd __user *user_cmd)
+{
+    struct resource_container_multilock_cmd cmd;
+    lock_block** lblocks = NULL;
+    int shared, count, i, ret = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    count = multilock_prepare(&cmd, &lblocks);
+    if(count <= 0){
+        return count;
+    }
+
+    shared = cmd.flags & RCONTAINER_LOCK_SHARED;
+    for(i = 0; i < count; i++){
+        if(cmd.flags & RCONTAINER_LOCK_TRY){
+            if(!lock_word_trylock(lblocks[i], shared)){
+                ret = -EAGAIN;
+                break;
+            }
+            lock_stat_acquired(lblocks[i], shared, 0);
+        }
+        else if((ret = lock_wait(lblocks[i], shared))){
+            break;
+        }
+    }
+    if(ret){
+        while(i-- > 0){
+            lock_word_release(lblocks[i]);
+        }
+    }
+    for(i = 0; i < count; i++){
+        lock_put(lblocks[i]);
+    }
+    kfree(lblocks);
+    return ret;
+}
+
+/**
+ * release the locks of several objects taken with RCONTAINER_IOCTL_MULTILOCK (or one by one).
+ * Every lock is released even if one of them is not held, -EPERM is returned then.
+ */
+int resource_container_multiunlock(struct resource_container_multilock_cmd __user *user_cmd)
+{
+    struct resource_container_multilock_cmd cmd;
+    lock_block** lblocks = NULL;
+    int count, i, ret = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    count = multilock_prepare(&cmd, &lblocks);
+    if(count <= 0){
+        return count;
+    }
+    for(i = count - 1; i >= 0; i--){
+        if(lock_word_release(lblocks[i])){
+            ret = -EPERM;
+        }
+        lock_put(lblocks[i]);
+    }
+    kfree(lblocks);
+    return ret;
+}
+
+/**
+ * unlock the container that is register by the current task.
+ * Releases an exclusive or a shared hold, the library calls in here when the waiter bit is set in the lock word.
+ * return -EPERM if the lock is not held
+ */
+int resource_container_unlock(struct resource_container_cmd __user *user_cmd)
+{
+    struct resource_container_cmd cmd;
+    lock_block* lblock;
+    int ret;
+    //debug statement
+    // printk("resource_container_unlock start\n"); 
+    
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -1;
+    }
+
+    lblock = lock_lookup(cmd.oid);
+    if(lblock == NULL){
+        printk(KERN_ERR "unlock a lock not created yet\n");
+        return -EINVAL;
+    }
+
+    ret = lock_word_release(lblock);
+    lock_put(lblock);
+    //debug statement
+    // printk("resource_container_unlock end\n"); 
+    return ret;
+}
+
+/**
+ * Return the slot of the lock word of cmd.oid in the container's lock page, creating the lock if needed.
+ * -ENOSPC means the lock has no slot and every operation on it goes through the ioctls.
+ */
+int resource_container_lock_slot(struct resource_container_cmd __user *user_cmd)
+{
+    struct resource_container_cmd cmd;
+    lock_block* lblock;
+    int slot;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    lblock = lock_lookup(cmd.oid);
+    if(lblock == NULL){
+        return -EINVAL;
+    }
+    slot = lblock->slot;
+    lock_put(lblock);
+    return (slot < 0) ? -ENOSPC : slot;
+}
+
+
+
+
+// memory_lookup: find the object oid of the container registered by the current task and take a reference on it,
+// so the caller can work on it without holding mlock. Drop the reference with memory_put.
+memory_block* memory_lookup(unsigned long int oid){
+    container_block* cblock;
+    memory_block* mblock = NULL;
+
+    mutex_lock(&mlock);
+    cblock = search_all_container_tid(current->pid);
+    if(cblock != NULL){
+        mblock = search_memory(cblock, oid);
+    }
+    if(mblock != NULL){
+        atomic_inc(&mblock->refs);
+    }
+    mutex_unlock(&mlock);
+    return mblock;
+}
+
+/**
+ * fetch-add, exchange or compare-exchange a 4 or 8 byte word of an object without taking the container lock.
+ * The operation runs on the object's page in the kernel, so it is atomic with respect to user-space atomics on the mapping.
+ */
+int resource_container_atomic(struct file *filp, struct resource_container_atomic_cmd __user *user_cmd)
+{
+    struct resource_container_atomic_cmd cmd;
+    memory_block* mblock;
+    int ret;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    mblock = memory_lookup(cmd.oid);
+    if(mblock == NULL){
+        return -ENOENT;
+    }
+    ret = memory_atomic(mblock, &cmd, filp->f_mapping);
+    memory_put(mblock);
+
+    if(ret == 0 && put_user(cmd.result, &user_cmd->result)){
+        return -EFAULT;
+    }
+    return ret;
+}
+
+/**
+ * run an array of atomic operations in order, stopping at the first one that fails.
+ * return the number of operations done, or the error of the first one if none was done
+ */
+int resource_container_atomic_batch(struct file *filp, struct resource_container_atomic_batch __user *user_cmd)
+{
+    struct resource_container_atomic_batch batch;
+    struct resource_container_atomic_cmd* ops;
+    struct resource_container_atomic_cmd __user *user_ops;
+    memory_block* mblock = NULL;
+    int i, ret = 0;
+
+    if (copy_from_user(&batch, user_cmd, sizeof(batch)))
+    {
+        return -EFAULT;
+    }
+    if(batch.count == 0){
+        return 0;
+    }
+    if(batch.count > RCONTAINER_ATOMIC_BATCH_MAX){
+        return -E2BIG;
+    }
+
+    user_ops = u64_to_user_ptr(batch.ops);
+    ops = kmalloc_array(batch.count, sizeof(*ops), GFP_KERNEL);
+    if(ops == NULL){
+        return -ENOMEM;
+    }
+    if(copy_from_user(ops, user_ops, batch.count * sizeof(*ops))){
+        kfree(ops);
+        return -EFAULT;
+    }
+
+    for(i = 0; i < batch.count; i++){
+        //consecutive operations on the same object reuse the reference
+        if(mblock == NULL || mblock->oid != ops[i].oid){
+            if(mblock != NULL){
+                memory_put(mblock);
+            }
+            mblock = memory_lookup(ops[i].oid);
+            if(mblock == NULL){
+                ret = -ENOENT;
+                break;
+            }
+        }
+        ret = memory_atomic(mblock, &ops[i], filp->f_mapping);
+        if(ret){
+            break;
+        }
+        if(put_user(ops[i].result, &user_ops[i].result)){
+            ret = -EFAULT;
+            break;
+        }
+    }
+    if(mblock != NULL){
+        memory_put(mblock);
+    }
+    kfree(ops);
+    return (i > 0) ? i : ret;
+}
+
+/**
+ * wait until the object is notified, i.e. its version differs from cmd.version.
+ * Shares of an object wait on the version of the object that owns the pages.
+ * Waiters sleep exclusively, so a notify of n wakes at most n of them.
+ */
+int resource_container_wait(struct file *filp, struct resource_container_wait_cmd __user *user_cmd)
+{
+    struct resource_container_wait_cmd cmd;
+    file_block* fblock = filp->private_data;
+    memory_block* mblock;
+    memory_block* backing;
+    int ret = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    mblock = memory_lookup(cmd.oid);
+    if(mblock == NULL){
+        return -ENOENT;
+    }
+    backing = memory_backing(mblock);
+
+    if(cmd.flags & RCONTAINER_WAIT_POLL){
+        file_disarm(fblock);
+        if((u32)atomic_read(&backing->version) == cmd.version){
+            //report the version the fd is armed with, the object may be notified right after it is published
+            //the reference moves to the fd and is dropped when it is disarmed or closed
+            spin_lock(&fblock->lock);
+            fblock->armed = mblock;
+            fblock->armed_version = cmd.version;
+            spin_unlock(&fblock->lock);
+            mblock = NULL;
+            ret = -EAGAIN;
+        }
+    }
+    else if(cmd.flags & RCONTAINER_WAIT_NONBLOCK){
+        if((u32)atomic_read(&backing->version) == cmd.version){
+            ret = -EAGAIN;
+        }
+    }
+    else if(wait_event_interruptible_exclusive(backing->notify_wait,
+                (u32)atomic_read(&backing->version) != cmd.version)){
+        ret = -EINTR;
+    }
+
+    if(mblock != NULL){
+        cmd.version = atomic_read(&backing->version);
+        memory_put(mblock);
+    }
+    if(put_user(cmd.version, &user_cmd->version)){
+        return -EFAULT;
+    }
+    return ret;
+}
+
+// memory_notify: bump the version of mblock and wake count of its waiters (all of them if count is 0).
+// Pollers wait on the same queue without the exclusive flag, so every one of them is woken.
+// return the new version
+u32 memory_notify(memory_block* mblock, u32 count){
+    memory_block* backing = memory_backing(mblock);
+    u32 version = atomic_inc_return(&backing->version);
+
+    if(count == 0){
+        wake_up_all(&backing->notify_wait);
+    }
+    else{
+        wake_up_nr(&backing->notify_wait, count);
+    }
+    return version;
+}
+
+/**
+ * bump the version of the object and wake cmd.count of its waiters (all of them if cmd.count is 0),
+ * along with every poller of a device fd armed on it.
+ */
+int resource_container_notify(struct resource_container_notify_cmd __user *user_cmd)
+{
+    struct resource_container_notify_cmd cmd;
+    memory_block* mblock;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    mblock = memory_lookup(cmd.oid);
+    if(mblock == NULL){
+        return -ENOENT;
+    }
+    cmd.version = memory_notify(mblock, cmd.count);
+    memory_put(mblock);
+
+    if(put_user(cmd.version, &user_cmd->version)){
+        return -EFAULT;
+    }
+    return 0;
+}
+
+/**
+ * report the contention counters of the lock of cmd.oid in the container registered by the current task.
+ */
+int resource_container_lock_stats(struct resource_container_lock_stats __user *user_cmd)
+{
+    struct resource_container_lock_stats cmd;
+    struct lock_stats sum;
+    container_block* cblock;
+    lock_block* lblock = NULL;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    mutex_lock(&mlock);
+    cblock = search_all_container_tid(current->pid);
+    if(cblock != NULL){
+        lblock = search_lock(cblock, cmd.oid);
+    }
+    if(lblock == NULL){
+        mutex_unlock(&mlock);
+        return -ENOENT;
+    }
+    lock_stat_sum(lblock, &sum);
+    cmd.acquisitions = sum.acquisitions;
+    cmd.user_acquisitions = lock_slot_acquisitions(cblock, lblock);
+    cmd.contended = sum.contended;
+    cmd.wait_ns = sum.wait_ns;
+    cmd.wait_max_ns = sum.wait_max_ns;
+    cmd.hold_ns = sum.hold_ns;
+    cmd.holder = READ_ONCE(lblock->holder);
+    cmd.reserved = 0;
+    mutex_unlock(&mlock);
+
+    if (copy_to_user(user_cmd, &cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    return 0;
+}
+
+/**
+ * Report the CPU time and scheduling statistics of the container cmd.cid, and of up to cmd.count of its threads.
+ * The CPU time is read from the member tasks here, the switch only counts turns and parked time.
+ * Only allowed when the caller may access the container (see container_access_ok), -EPERM otherwise.
+ * return 0 on success
+ */
+int resource_container_stats(struct resource_container_stats __user *user_cmd)
+{
+    struct resource_container_stats cmd;
+    struct resource_container_thread_stats* threads = NULL;
+    container_block* cblock;
+    thread_block* tblock;
+    u32 n = 0;
+    u64 now;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    if(cmd.threads == 0){
+        cmd.count = 0;
+    }
+
+    mutex_lock(&mlock);
+    cblock = search_container_create(cmd.cid);
+    if(cblock == NULL){
+        mutex_unlock(&mlock);
+        return -ENOENT;
+    }
+    if(!container_access_ok(cblock)){
+        mutex_unlock(&mlock);
+        return -EPERM;
+    }
+    //the buffer is sized by the threads there are, not by what user space asked for
+    for(tblock = cblock->first_thread; tblock != NULL && n < cmd.count; tblock = tblock->next_thread){
+        n++;
+    }
+    cmd.count = n;
+    n = 0;
+    if(cmd.count != 0){
+        threads = kvmalloc_array(cmd.count, sizeof(*threads), GFP_KERNEL);
+        if(threads == NULL){
+            mutex_unlock(&mlock);
+            return -ENOMEM;
+        }
+    }
+    now = ktime_get_ns();
+    cmd.nr_threads = 0;
+    for(tblock = cblock->first_thread; tblock != NULL; tblock = tblock->next_thread){
+        if(n < cmd.count){
+            threads[n].tid = tblock->tid;
+            threads[n].reserved = 0;
+            threads[n].turns = tblock->turns;
+            threads[n].runtime_ns = thread_runtime(tblock);
+            threads[n].parked_ns = thread_parked(tblock, now);
+            n++;
+        }
+        cmd.nr_threads++;
+    }
+    cmd.runtime_ns = container_runtime(cblock);
+    cmd.switches = cblock->switches;
+    cmd.parked_ns = container_parked(cblock, now);
+    cmd.quota_ns = cblock->quota_ns;
+    cmd.timeslice_ns = cblock->timeslice_ns;
+    cmd.weight = cblock->weight;
+    mutex_unlock(&mlock);
+    cmd.count = n;
+
+    if(n != 0 && copy_to_user(u64_to_user_ptr(cmd.threads), threads, n * sizeof(*threads))){
+        kvfree(threads);
+        return -EFAULT;
+    }
+    kvfree(threads);
+    if (copy_to_user(user_cmd, &cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    return 0;
+}
+
+// debugfs <root>/containers: one line per container, runtime_ns against quota_ns for billing, parked_ns for fairness
+static int containers_show(struct seq_file *m, void *v)
+{
+    container_block* cblock;
+    thread_block* tblock;
+    int nr_threads;
+    u64 now;
+
+    seq_puts(m, "cid threads runtime_ns switches parked_ns quota_ns timeslice_ns weight\n");
+    mutex_lock(&mlock);
+    now = ktime_get_ns();
+    for(cblock = first_container; cblock != NULL; cblock = cblock->next_container){
+        nr_threads = 0;
+        for(tblock = cblock->first_thread; tblock != NULL; tblock = tblock->next_thread){
+            nr_threads++;
+        }
+        seq_printf(m, "%d %d %llu %llu %llu %llu %llu %u\n", cblock->cid, nr_threads, container_runtime(cblock),
+                   cblock->switches, container_parked(cblock, now), cblock->quota_ns, cblock->timeslice_ns,
+                   cblock->weight);
+    }
+    mutex_unlock(&mlock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(containers);
+
+// debugfs <root>/locks: one line per lock of every container, hot objects show up with large contended and wait_ns
+static int locks_show(struct seq_file *m, void *v)
+{
+    container_block* cblock;
+    lock_block* lblock;
+    struct lock_stats sum;
+
+    seq_puts(m, "cid oid acquisitions contended wait_ns wait_max_ns hold_ns holder user_acquisitions_advisory\n");
+    mutex_lock(&mlock);
+    for(cblock = first_container; cblock != NULL; cblock = cblock->next_container){
+        for(lblock = cblock->first_lock; lblock != NULL; lblock = lblock->next_lock){
+            lock_stat_sum(lblock, &sum);
+            seq_printf(m, "%d %lu %llu %llu %llu %llu %llu %d %llu\n", cblock->cid, lblock->lid,
+                       sum.acquisitions, sum.contended, sum.wait_ns, sum.wait_max_ns, sum.hold_ns,
+                       READ_ONCE(lblock->holder), lock_slot_acquisitions(cblock, lblock));
+        }
+    }
+    mutex_unlock(&mlock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(locks);
+
+// latency_sum: add up the histogram op of every CPU
+static void latency_sum(int op, struct latency_hist* sum){
+    struct latency_hist* hist;
+    int cpu, i;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu){
+        hist = &per_cpu_ptr(&latency_hists, cpu)->op[op];
+        sum->count += READ_ONCE(hist->count);
+        sum->sum_ns += READ_ONCE(hist->sum_ns);
+        for(i = 0; i < RCONTAINER_LATENCY_BUCKETS; i++){
+            sum->buckets[i] += READ_ONCE(hist->buckets[i]);
+        }
+    }
+}
+
+// latency_reset: clear the histogram op on every CPU. Operations recorded meanwhile may be half counted.
+static void latency_reset(int op){
+    int cpu;
+
+    for_each_possible_cpu(cpu){
+        memset(&per_cpu_ptr(&latency_hists, cpu)->op[op], 0, sizeof(struct latency_hist));
+    }
+}
+
+// latency_percentile: upper bound of the bucket that holds the permille-th operation of hist, 0 if it is empty
+static u64 latency_percentile(struct latency_hist* hist, int permille){
+    return rcontainer_latency_bucket_percentile(hist->buckets, hist->count, permille);
+}
+
+/**
+ * Read the latency histogram of cmd.op, and clear it with RCONTAINER_LATENCY_RESET.
+ * Clearing needs CAP_SYS_ADMIN (-EPERM): the histograms are shared by every user of the module.
+ * return 0 on success
+ */
+int resource_container_latency(struct resource_container_latency __user *user_cmd)
+{
+    struct resource_container_latency cmd;
+    struct latency_hist sum;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    if(cmd.op >= RCONTAINER_LAT_OPS){
+        return -EINVAL;
+    }
+    if((cmd.flags & RCONTAINER_LATENCY_RESET) && !capable(CAP_SYS_ADMIN)){
+        return -EPERM;
+    }
+    latency_sum(cmd.op, &sum);
+    if(cmd.flags & RCONTAINER_LATENCY_RESET){
+        latency_reset(cmd.op);
+    }
+    cmd.count = sum.count;
+    cmd.sum_ns = sum.sum_ns;
+    memcpy(cmd.buckets, sum.buckets, sizeof(cmd.buckets));
+    if (copy_to_user(user_cmd, &cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    return 0;
+}
+
+static const char* const latency_names[RCONTAINER_LAT_OPS] = {
+    "create", "delete", "switch", "lock", "unlock", "free", "mmap", "other",
+};
+
+// debugfs <root>/latency: percentiles are bucket upper bounds, so they are accurate to a factor of 2.
+// Writing anything to the file clears every histogram, for CAP_SYS_ADMIN only like RCONTAINER_LATENCY_RESET.
+static int latency_show(struct seq_file *m, void *v)
+{
+    struct latency_hist sum;
+    int op;
+
+    seq_puts(m, "op count avg_ns p50_ns p99_ns p999_ns\n");
+    for(op = 0; op < RCONTAINER_LAT_OPS; op++){
+        latency_sum(op, &sum);
+        seq_printf(m, "%s %llu %llu %llu %llu %llu\n", latency_names[op], sum.count,
+                   sum.count ? div64_u64(sum.sum_ns, sum.count) : 0, latency_percentile(&sum, 500),
+                   latency_percentile(&sum, 990), latency_percentile(&sum, 999));
+    }
+    return 0;
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, latency_show, inode->i_private);
+}
 
-    cblock = switch_target_container;          //Obtain the continer that need to switch
+static ssize_t latency_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    int op;
 
-    if(cblock == NULL){
-        printk( "No container exist");
-        mutex_unlock(&mlock); 
-        return 0;
+    if(!capable(CAP_SYS_ADMIN)){
+        return -EPERM;
     }
+    for(op = 0; op < RCONTAINER_LAT_OPS; op++){
+        latency_reset(op);
+    }
+    return count;
+}
 
+static const struct file_operations latency_fops = {
+    .owner = THIS_MODULE,
+    .open = latency_open,
+    .read = seq_read,
+    .write = latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
 
-    if(cblock->first_thread != cblock->last_thread){        //if there are more than 1 thread
-
-            
-        curr_tblock = cblock->running_thread;
-        
-        if(cblock->running_thread == cblock->last_thread){      // if the current running thread is the last thread within the container
-            cblock->running_thread = cblock->first_thread;
-        }
-        else{
-            cblock->running_thread = cblock->running_thread->next_thread;
-        }
+// Per-container files <root>/<cid>/{threads,objects,locks}. They are created without debugfs' removal
+// protection and carry the cid instead of the container, so the container can be destroyed (and its directory
+// removed) under mlock while a reader waits for mlock: the reader then finds no container and prints the header only.
+// Each read holds mlock for one container.
+static struct dentry* debugfs_root;
 
-        printk("%d: trying to switch to: %d",current->pid, cblock->running_thread->tid); 
+// container_debugfs_lookup: the container a per-container file belongs to, NULL if it is gone. Caller holds mlock.
+static container_block* container_debugfs_lookup(struct seq_file *m){
+    return search_container_create((int)(long)m->private);
+}
 
-        wake_up_process(cblock->running_thread->task_info);
-        curr_tblock->task_info->state = (TASK_INTERRUPTIBLE);
-        
+// debugfs <root>/<cid>/threads: the member threads, and which one has the turn
+static int container_threads_show(struct seq_file *m, void *v)
+{
+    container_block* cblock;
+    thread_block* tblock;
+    u64 now;
 
-    }        
+    seq_puts(m, "tid running turns runtime_ns parked_ns\n");
+    mutex_lock(&mlock);
+    cblock = container_debugfs_lookup(m);
+    now = ktime_get_ns();
+    for(tblock = (cblock != NULL) ? cblock->first_thread : NULL; tblock != NULL; tblock = tblock->next_thread){
+        seq_printf(m, "%d %d %llu %llu %llu\n", tblock->tid, cblock->running_thread == tblock, tblock->turns,
+                   thread_runtime(tblock), thread_parked(tblock, now));
+    }
+    mutex_unlock(&mlock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(container_threads);
 
-    if(switch_target_container == last_container){
-        switch_target_container = first_container;
+// memory_kind: what kind of object mblock is, for the objects file
+static const char* memory_kind(memory_block* mblock){
+    if(mblock->origin != NULL){
+        return "share";
     }
-    else{
-        switch_target_container = switch_target_container->next_container;
+    if(mblock->backing_file != NULL){
+        return "persistent";
     }
+    return (mblock->restore_pos != NULL) ? "restored" : "object";
+}
 
-    mutex_unlock(&mlock); 
-    schedule();
+// memory_sharers: number of read-only shares of mblock in other containers. Caller holds mlock.
+static int memory_sharers(memory_block* mblock){
+    container_block* cblock;
+    memory_block* share;
+    int sharers = 0;
 
-    //debug statement
-    printk("%d: finish switch", current->pid); 
-    return 0;
+    for(cblock = first_container; cblock != NULL; cblock = cblock->next_container){
+        for(share = cblock->first_memory; share != NULL; share = share->next_memory){
+            sharers += (share->origin == mblock);
+        }
+    }
+    return sharers;
 }
-/**
- * Allocates memory in kernal space for sharing with tasks in the same container and 
- * maps the virtual address to the physical address.
- */
-int resource_container_mmap(struct file *filp, struct vm_area_struct *vma)
-{
-    int ret;
-    container_block* temp_container;
-    memory_block* temp_memory = NULL;
-    unsigned long pfn;
-    tid_block* tblock;
 
-    //remap_pfn_range can be use?
-    //debug statement
-    // printk("%d: resource_container_mmap start\n", current->pid); 
+// debugfs <root>/<cid>/objects: the objects of the container, refs counts the container list and every mapping
+static int container_objects_show(struct seq_file *m, void *v)
+{
+    container_block* cblock;
+    memory_block* mblock;
 
+    seq_puts(m, "oid size kind refs sharers version\n");
     mutex_lock(&mlock);
+    cblock = container_debugfs_lookup(m);
+    for(mblock = (cblock != NULL) ? cblock->first_memory : NULL; mblock != NULL; mblock = mblock->next_memory){
+        seq_printf(m, "%lu %lu %s %d %d %d\n", mblock->oid, memory_backing(mblock)->nr_pages << PAGE_SHIFT,
+                   memory_kind(mblock), atomic_read(&mblock->refs), memory_sharers(mblock),
+                   atomic_read(&mblock->version));
+    }
+    mutex_unlock(&mlock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(container_objects);
 
-    temp_container = search_all_container_tid(current->pid);
-
-    // if(temp_container == NULL){
-    //     printk("container not found with pid: %d", current->pid);
-    // }
-    // else{
-    //     printk("The cid for container is %d", temp_container->cid);
-    // }
-
-    temp_memory = search_memory(temp_container, vma->vm_pgoff);
+// debugfs <root>/<cid>/locks: the state of every lock of the container, the counters are in <root>/locks
+static int container_locks_show(struct seq_file *m, void *v)
+{
+    container_block* cblock;
+    lock_block* lblock;
+    int word;
 
-    if(temp_memory == NULL){
-        // printk("    %d: Need to allocate new memory", current->pid);
-        temp_memory = new_memory_create(temp_container, vma->vm_pgoff, vma->vm_end - vma->vm_start);
+    seq_puts(m, "lid state readers waiters holder slot\n");
+    mutex_lock(&mlock);
+    cblock = container_debugfs_lookup(m);
+    for(lblock = (cblock != NULL) ? cblock->first_lock : NULL; lblock != NULL; lblock = lblock->next_lock){
+        word = atomic_read(lblock->word);
+        seq_printf(m, "%lu %s %d %d %d %d\n", lblock->lid,
+                   (word & RCONTAINER_LOCK_HELD) ? "held" : ((word & RCONTAINER_LOCK_READERS) ? "shared" : "free"),
+                   word & RCONTAINER_LOCK_READERS, atomic_read(&lblock->waiters), READ_ONCE(lblock->holder),
+                   lblock->slot);
     }
+    mutex_unlock(&mlock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(container_locks);
 
-    tblock = search_memory_tid(temp_memory, current->pid);
+// container_debugfs_create: create the debugfs directory of cblock. Caller holds mlock.
+void container_debugfs_create(container_block* cblock){
+    char name[12];
+    void* cid = (void *)(long)cblock->cid;
 
-    //search is the tid that use current allocate memory recorded. Use for free the memory when all thread called free
-    if(tblock == NULL){
-        tblock = new_memory_tid_create(temp_memory, current->pid);
+    cblock->debugfs = NULL;
+    if(debugfs_root == NULL){
+        return;
     }
+    snprintf(name, sizeof(name), "%d", cblock->cid);
+    cblock->debugfs = debugfs_create_dir(name, debugfs_root);
+    if(IS_ERR_OR_NULL(cblock->debugfs)){
+        cblock->debugfs = NULL;
+        return;
+    }
+    debugfs_create_file_unsafe("threads", 0444, cblock->debugfs, cid, &container_threads_fops);
+    debugfs_create_file_unsafe("objects", 0444, cblock->debugfs, cid, &container_objects_fops);
+    debugfs_create_file_unsafe("locks", 0444, cblock->debugfs, cid, &container_locks_fops);
+}
 
-    pfn = virt_to_phys((void *)temp_memory->m_address)>>PAGE_SHIFT;
+// resource_container_debugfs_init: populate the debugfs directory of the module
+void resource_container_debugfs_init(struct dentry* root){
+    debugfs_root = root;
+    debugfs_create_file("locks", 0444, root, NULL, &locks_fops);
+    debugfs_create_file("containers", 0444, root, NULL, &containers_fops);
+    debugfs_create_file("latency", 0644, root, NULL, &latency_fops);
+}
 
-    ret = remap_pfn_range(vma, vma->vm_start, pfn, vma->vm_end - vma->vm_start, vma->vm_page_prot);
+// object_free: remove the object oid from the container registered by the current task
+// return 0 on success, -EINVAL if there is no such object
+int object_free(unsigned long int oid){
+    container_block* cblock;
+    memory_block* mblock;
+    tid_block* tblock;
 
-    if (ret < 0) {
-        printk(KERN_ERR "Wrong with mapping data");
+    mutex_lock(&mlock);
+    cblock = search_all_container_tid(current->pid);
+    mblock = (cblock == NULL) ? NULL : search_memory(cblock, oid);
+    if(cblock == NULL || mblock == NULL){
+        printk(KERN_ERR "Wrong with free function: something is NULL");
         mutex_unlock(&mlock);
-        return ret;
+        return -EINVAL;
+    }
+    //an object transferred from another container has no user recorded until someone maps it
+    tblock = search_memory_tid(mblock, current->pid);
+    if(tblock == NULL && mblock->first_tid != NULL){
+        printk(KERN_ERR "Wrong with free function: something is NULL");
+        mutex_unlock(&mlock);
+        return -EINVAL;
     }
+    trace_rcontainer_free(cblock->cid, oid);
+    memory_remove(cblock, mblock, tblock);
+    mutex_unlock(&mlock);
+    return 0;
+}
 
-    // printk("The vma page offset value is: %lu", vma->vm_pgoff);
+// object_alloc: create object oid of size bytes in the container registered by the current task, unless it exists
+// Mapping the oid later finds the object instead of creating it.
+// return 0 on success, or a negative error
+int object_alloc(unsigned long int oid, unsigned long size){
+    container_block* cblock;
+    int ret = 0;
 
-    //debug statement
-    // printk("resource_container_mmap end\n");
-    mutex_unlock(&mlock); 
-    // printk("%d: resource_container_mmap after lock\n", current->pid); 
+    if(size == 0){
+        return -EINVAL;
+    }
+    mutex_lock(&mlock);
+    cblock = search_all_container_tid(current->pid);
+    if(cblock == NULL){
+        ret = -EINVAL;
+    }
+    else if(search_memory(cblock, oid) == NULL && new_memory_create(cblock, oid, size) == NULL){
+        ret = -ENOMEM;
+    }
+    mutex_unlock(&mlock);
     return ret;
-
 }
 
 /**
- * lock the container that is register by the current task.
+ * select the object cmd.oid of the caller's container for read, write and splice on this fd.
+ * The file offset is left alone, the ioctl does not hold the f_pos lock; rewind with lseek (the library does).
  */
-int resource_container_lock(struct resource_container_cmd __user *user_cmd)
+int resource_container_select(struct file *filp, struct resource_container_cmd __user *user_cmd)
 {
     struct resource_container_cmd cmd;
-    container_block* cblock;
-    lock_block* lblock;
-    //debug statement
-    // printk("resource_container_lock start\n"); 
-    
+    file_block* fblock = filp->private_data;
+    memory_block* mblock;
+    memory_block* old;
+
     if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
     {
-        return -1;
+        return -EFAULT;
     }
-
-    cblock = search_all_container_tid(current->pid);
-    lblock = search_lock(cblock, cmd.oid);
-
-    if(lblock == NULL){
-        lblock = new_lock_create(cblock,cmd.oid);
+    mblock = memory_lookup(cmd.oid);
+    if(mblock == NULL){
+        return -ENOENT;
     }
 
-
-    mutex_lock(lblock->lock);
-    //debug statement
-    // printk("resource_container_lock end\n"); 
+    spin_lock(&fblock->lock);
+    old = fblock->selected;
+    fblock->selected = mblock;
+    spin_unlock(&fblock->lock);
+    if(old != NULL){
+        memory_put(old);
+    }
     return 0;
 }
 
 /**
- * unlock the container that is register by the current task.
+ * clean the content of the object in the container that is register by the current task.
  */
-int resource_container_unlock(struct resource_container_cmd __user *user_cmd)
+int resource_container_free(struct resource_container_cmd __user *user_cmd)
 {
     struct resource_container_cmd cmd;
-    container_block* cblock;
-    lock_block* lblock;
+    int ret;
     //debug statement
-    // printk("resource_container_unlock start\n"); 
+    // printk("resource_container_free start\n"); 
     
     if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
     {
         return -1;
     }
 
-    cblock = search_all_container_tid(current->pid);
-    lblock = search_lock(cblock, cmd.oid);
+    ret = object_free(cmd.oid);
+    //debug statement
+    // printk("resource_container_free end\n"); 
+    return ret;
+}
 
-    if(lblock == NULL){
-        printk(KERN_ERR "unlock a lock not created yet\n");
+// batch_entry_run: run one command of a batch, the result goes to entry->result
+// return the result
+int batch_entry_run(struct file *filp, struct resource_container_batch_entry* entry){
+    struct resource_container_atomic_cmd atomic_cmd;
+    memory_block* mblock;
+    lock_block* lblock;
+    int shared;
+
+    switch(entry->op){
+    case RCONTAINER_OP_LOCK:
+    case RCONTAINER_OP_RDLOCK:
+    case RCONTAINER_OP_TRYLOCK:
+    case RCONTAINER_OP_TRYRDLOCK:
+    case RCONTAINER_OP_UNLOCK:
+        lblock = lock_lookup(entry->oid);
+        if(lblock == NULL){
+            entry->result = -EINVAL;
+            break;
+        }
+        shared = (entry->op == RCONTAINER_OP_RDLOCK || entry->op == RCONTAINER_OP_TRYRDLOCK);
+        if(entry->op == RCONTAINER_OP_UNLOCK){
+            entry->result = lock_word_release(lblock);
+        }
+        else if(entry->op == RCONTAINER_OP_TRYLOCK || entry->op == RCONTAINER_OP_TRYRDLOCK){
+            entry->result = lock_word_trylock(lblock, shared) ? 0 : -EAGAIN;
+            if(entry->result == 0){
+                lock_stat_acquired(lblock, shared, 0);
+            }
+        }
+        else{
+            entry->result = lock_wait(lblock, shared);
+        }
+        lock_put(lblock);
+        break;
+    case RCONTAINER_OP_FREE:
+        entry->result = object_free(entry->oid);
+        break;
+    case RCONTAINER_OP_ALLOC:
+        entry->result = object_alloc(entry->oid, entry->arg);
+        break;
+    case RCONTAINER_OP_FETCH_ADD:
+    case RCONTAINER_OP_XCHG:
+    case RCONTAINER_OP_CMPXCHG:
+    case RCONTAINER_OP_NOTIFY:
+        mblock = memory_lookup(entry->oid);
+        if(mblock == NULL){
+            entry->result = -ENOENT;
+            break;
+        }
+        if(entry->op == RCONTAINER_OP_NOTIFY){
+            memory_notify(mblock, entry->arg);
+            entry->result = 0;
+        }
+        else{
+            atomic_cmd.oid = entry->oid;
+            atomic_cmd.offset = entry->arg;
+            atomic_cmd.op = RCONTAINER_ATOMIC_ADD + (entry->op - RCONTAINER_OP_FETCH_ADD);
+            atomic_cmd.size = entry->size;
+            atomic_cmd.value = entry->value;
+            atomic_cmd.expected = entry->expected;
+            entry->result = memory_atomic(mblock, &atomic_cmd, filp->f_mapping);
+            if(entry->result == 0){
+                entry->value = atomic_cmd.result;
+            }
+        }
+        memory_put(mblock);
+        break;
+    default:
+        entry->result = -EINVAL;
+        break;
     }
+    return entry->result;
+}
 
-    mutex_unlock(lblock->lock);
-    //debug statement
-    // printk("resource_container_unlock end\n"); 
+// batch_held_release: pair the unlock entries[i] with the latest lock of the same oid taken earlier in the batch
+// return 1 if there was one, its bit in held is cleared
+int batch_held_release(struct resource_container_batch_entry* entries, unsigned long* held, int i){
+    int j;
+
+    for(j = i - 1; j >= 0; j--){
+        if(test_bit(j, held) && entries[j].oid == entries[i].oid){
+            __clear_bit(j, held);
+            return 1;
+        }
+    }
     return 0;
 }
 
+/**
+ * run an array of commands in one kernel entry, e.g. lock, update a word, unlock.
+ * Entries run in order; after the first failure the rest are not run and get -ECANCELED, except unlocks of
+ * locks this batch took and still holds, which run so that a failed batch does not leave its locks held.
+ * An unlock of a lock taken outside the batch is cancelled too: the lock word has no owner, so the kernel
+ * cannot tell whether the lock it would release is the caller's (e.g. after a trylock that failed).
+ * Every entry's result (and value for the atomics) is written back.
+ * return the number of entries that succeeded before the first failure
+ */
+int resource_container_batch(struct file *filp, struct resource_container_batch_cmd __user *user_cmd)
+{
+    struct resource_container_batch_cmd cmd;
+    struct resource_container_batch_entry* entries;
+    DECLARE_BITMAP(held, RCONTAINER_BATCH_MAX);     //entries whose lock the batch holds
+    int i, done = 0, failed = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+    if(cmd.count == 0){
+        return 0;
+    }
+    if(cmd.count > RCONTAINER_BATCH_MAX){
+        return -E2BIG;
+    }
+
+    entries = kmalloc_array(cmd.count, sizeof(*entries), GFP_KERNEL);
+    if(entries == NULL){
+        return -ENOMEM;
+    }
+    if(copy_from_user(entries, u64_to_user_ptr(cmd.entries), cmd.count * sizeof(*entries))){
+        kfree(entries);
+        return -EFAULT;
+    }
 
+    bitmap_zero(held, RCONTAINER_BATCH_MAX);
+    for(i = 0; i < cmd.count; i++){
+        if(failed){
+            if(entries[i].op == RCONTAINER_OP_UNLOCK && batch_held_release(entries, held, i)){
+                batch_entry_run(filp, &entries[i]);
+            }
+            else{
+                entries[i].result = -ECANCELED;
+            }
+        }
+        else if(batch_entry_run(filp, &entries[i]) != 0){
+            failed = 1;
+        }
+        else{
+            done++;
+            if(entries[i].op == RCONTAINER_OP_UNLOCK){
+                batch_held_release(entries, held, i);
+            }
+            else if(entries[i].op == RCONTAINER_OP_LOCK || entries[i].op == RCONTAINER_OP_RDLOCK ||
+                    entries[i].op == RCONTAINER_OP_TRYLOCK || entries[i].op == RCONTAINER_OP_TRYRDLOCK){
+                __set_bit(i, held);
+            }
+        }
+    }
 
+    if(copy_to_user(u64_to_user_ptr(cmd.entries), entries, cmd.count * sizeof(*entries))){
+        done = -EFAULT;
+    }
+    kfree(entries);
+    return done;
+}
 
 /**
- * clean the content of the object in the container that is register by the current task.
+ * allocate the submission and completion rings of the fd, cmd.size gets the length to map at RCONTAINER_RING_OFFSET.
+ * Each fd has one pair of rings for its lifetime.
  */
-int resource_container_free(struct resource_container_cmd __user *user_cmd)
+int resource_container_ring_setup(struct file *filp, struct resource_container_ring_setup __user *user_cmd)
 {
-    struct resource_container_cmd cmd;
-    container_block* cblock;
-    memory_block* mblock;
-    tid_block* tblock;
-    //debug statement
-    // printk("resource_container_free start\n"); 
-    
+    struct resource_container_ring_setup cmd;
+    struct resource_container_ring_header* header;
+    file_block* fblock = filp->private_data;
+    size_t sq_offset, cq_offset, size;
+
     if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
     {
-        return -1;
+        return -EFAULT;
+    }
+    if(cmd.entries == 0 || cmd.entries > RCONTAINER_RING_MAX_ENTRIES || !is_power_of_2(cmd.entries)){
+        return -EINVAL;
     }
 
-    cblock = search_all_container_tid(current->pid);
-    mblock = search_memory(cblock,cmd.oid);
-    tblock = search_memory_tid(mblock, current->pid);
-    if(cblock == NULL || mblock == NULL || tblock == NULL){
-        printk(KERN_ERR "Wrong with free function: something is NULL");
+    sq_offset = L1_CACHE_ALIGN(sizeof(*header));
+    cq_offset = L1_CACHE_ALIGN(sq_offset + cmd.entries * sizeof(struct resource_container_ring_sqe));
+    size = PAGE_ALIGN(cq_offset + cmd.entries * sizeof(struct resource_container_ring_cqe));
+
+    mutex_lock(&fblock->ring_lock);
+    if(fblock->ring != NULL){
+        mutex_unlock(&fblock->ring_lock);
+        return -EBUSY;
+    }
+    header = vmalloc_user(size);
+    if(header == NULL){
+        mutex_unlock(&fblock->ring_lock);
+        return -ENOMEM;
+    }
+    header->entries = cmd.entries;
+    header->sq_offset = sq_offset;
+    header->cq_offset = cq_offset;
+    fblock->ring = header;
+    fblock->ring_size = size;
+    fblock->ring_entries = cmd.entries;
+    fblock->sq_offset = sq_offset;
+    fblock->cq_offset = cq_offset;
+    mutex_unlock(&fblock->ring_lock);
+
+    if(put_user((__u64)size, &user_cmd->size)){
+        return -EFAULT;
     }
-    memory_remove(cblock, mblock, tblock);
-    //debug statement
-    // printk("resource_container_free end\n"); 
     return 0;
 }
 
+/**
+ * run queued submissions of the fd's ring and post their completions.
+ * Stops early when the completion ring is full, so user space must reap completions to make progress.
+ * Each submission is taken, with a completion slot reserved for it, under ring_lock and run without it:
+ * a LOCK may sleep until another thread of the process submits the UNLOCK through the same ring.
+ * Completions are posted in the order the entries finish, which differs from the submission order when
+ * several threads enter the ring at once.
+ * return the number of submissions consumed
+ */
+int resource_container_ring_enter(struct file *filp, struct resource_container_ring_enter __user *user_cmd)
+{
+    struct resource_container_ring_enter cmd;
+    struct resource_container_ring_header* header;
+    struct resource_container_ring_sqe* sqes;
+    struct resource_container_ring_cqe* cqe;
+    struct resource_container_ring_sqe sqe;
+    file_block* fblock = filp->private_data;
+    u32 mask;
+    int done = 0;
+
+    if (copy_from_user(&cmd, user_cmd, sizeof(cmd)))
+    {
+        return -EFAULT;
+    }
+
+    mutex_lock(&fblock->ring_lock);
+    header = fblock->ring;
+    if(header == NULL){
+        mutex_unlock(&fblock->ring_lock);
+        return -EINVAL;
+    }
+    //the header is shared with user space, so the geometry and the kernel's indices come from the file block
+    //and every index is masked
+    mask = fblock->ring_entries - 1;
+    sqes = fblock->ring + fblock->sq_offset;
+
+    while(fblock->sq_head != smp_load_acquire(&header->sq_tail) && (cmd.to_submit == 0 || done < cmd.to_submit)){
+        if(fblock->cq_tail + fblock->cq_pending - smp_load_acquire(&header->cq_head) > mask){
+            break;
+        }
+        //copy the submission first, user space may still write to the slot
+        memcpy(&sqe, &sqes[fblock->sq_head & mask], sizeof(sqe));
+        smp_store_release(&header->sq_head, ++fblock->sq_head);
+        fblock->cq_pending++;
+        mutex_unlock(&fblock->ring_lock);
+
+        batch_entry_run(filp, &sqe.cmd);
+
+        mutex_lock(&fblock->ring_lock);
+        cqe = (struct resource_container_ring_cqe*)(fblock->ring + fblock->cq_offset) + (fblock->cq_tail & mask);
+        cqe->user_data = sqe.user_data;
+        cqe->result = sqe.cmd.result;
+        cqe->flags = 0;
+        //only a successful atomic has an old value to report, the rest would echo the submission back
+        cqe->value = 0;
+        if(sqe.cmd.result == 0 && (sqe.cmd.op == RCONTAINER_OP_FETCH_ADD || sqe.cmd.op == RCONTAINER_OP_XCHG ||
+                                   sqe.cmd.op == RCONTAINER_OP_CMPXCHG)){
+            cqe->value = sqe.cmd.value;
+        }
+        fblock->cq_pending--;
+        smp_store_release(&header->cq_tail, ++fblock->cq_tail);
+        done++;
+    }
+    mutex_unlock(&fblock->ring_lock);
+    return done;
+}
 
 /**
  * control function that receive the command in user space and pass arguments to
  * corresponding functions.
  */
 
-int resource_container_ioctl(struct file *filp, unsigned int cmd,
+static int resource_container_dispatch(struct file *filp, unsigned int cmd,
                                 unsigned long arg)
 {
     switch (cmd) {
@@ -1003,7 +4248,93 @@ int resource_container_ioctl(struct file *filp, unsigned int cmd,
         return resource_container_unlock((void __user *)arg);
     case RCONTAINER_IOCTL_FREE:
         return resource_container_free((void __user *)arg);
+    case RCONTAINER_IOCTL_TRANSFER:
+        return resource_container_transfer((void __user *)arg);
+    case RCONTAINER_IOCTL_SNAPSHOT:
+        return resource_container_snapshot(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_ATTACH:
+        return resource_container_attach((void __user *)arg);
+    case RCONTAINER_IOCTL_LOCK_SLOT:
+        return resource_container_lock_slot((void __user *)arg);
+    case RCONTAINER_IOCTL_RDLOCK:
+        return resource_container_rdlock((void __user *)arg);
+    case RCONTAINER_IOCTL_TRYLOCK:
+        return resource_container_trylock((void __user *)arg);
+    case RCONTAINER_IOCTL_TIMEDLOCK:
+        return resource_container_timedlock((void __user *)arg);
+    case RCONTAINER_IOCTL_MULTILOCK:
+        return resource_container_multilock((void __user *)arg);
+    case RCONTAINER_IOCTL_MULTIUNLOCK:
+        return resource_container_multiunlock((void __user *)arg);
+    case RCONTAINER_IOCTL_ATOMIC:
+        return resource_container_atomic(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_ATOMIC_BATCH:
+        return resource_container_atomic_batch(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_WAIT:
+        return resource_container_wait(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_NOTIFY:
+        return resource_container_notify((void __user *)arg);
+    case RCONTAINER_IOCTL_LOCK_STATS:
+        return resource_container_lock_stats((void __user *)arg);
+    case RCONTAINER_IOCTL_BATCH:
+        return resource_container_batch(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_RING_SETUP:
+        return resource_container_ring_setup(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_RING_ENTER:
+        return resource_container_ring_enter(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_MIGRATE:
+        return resource_container_migrate((void __user *)arg);
+    case RCONTAINER_IOCTL_SETUP:
+        return resource_container_setup((void __user *)arg);
+    case RCONTAINER_IOCTL_REGISTER:
+        return resource_container_register((void __user *)arg);
+    case RCONTAINER_IOCTL_SELECT:
+        return resource_container_select(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_CHECKPOINT:
+        return resource_container_checkpoint(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_RESTORE:
+        return resource_container_restore(filp, (void __user *)arg);
+    case RCONTAINER_IOCTL_STATS:
+        return resource_container_stats((void __user *)arg);
+    case RCONTAINER_IOCTL_LATENCY:
+        return resource_container_latency((void __user *)arg);
     default:
         return -ENOTTY;
     }
-}
\ No newline at end of file
+}
+
+// latency_op: the histogram an ioctl is recorded in
+static int latency_op(unsigned int cmd)
+{
+    switch (cmd) {
+    case RCONTAINER_IOCTL_CREATE:
+        return RCONTAINER_LAT_CREATE;
+    case RCONTAINER_IOCTL_DELETE:
+        return RCONTAINER_LAT_DELETE;
+    case RCONTAINER_IOCTL_CSWITCH:
+        return RCONTAINER_LAT_SWITCH;
+    case RCONTAINER_IOCTL_LOCK:
+    case RCONTAINER_IOCTL_RDLOCK:
+    case RCONTAINER_IOCTL_TRYLOCK:
+    case RCONTAINER_IOCTL_TIMEDLOCK:
+    case RCONTAINER_IOCTL_MULTILOCK:
+        return RCONTAINER_LAT_LOCK;
+    case RCONTAINER_IOCTL_UNLOCK:
+    case RCONTAINER_IOCTL_MULTIUNLOCK:
+        return RCONTAINER_LAT_UNLOCK;
+    case RCONTAINER_IOCTL_FREE:
+        return RCONTAINER_LAT_FREE;
+    default:
+        return RCONTAINER_LAT_OTHER;
+    }
+}
+
+int resource_container_ioctl(struct file *filp, unsigned int cmd,
+                                unsigned long arg)
+{
+    u64 start = ktime_get_ns();
+    int ret = resource_container_dispatch(filp, cmd, arg);
+
+    latency_record(latency_op(cmd), ktime_get_ns() - start);
+    return ret;
+}
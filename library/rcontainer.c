@@ -30,10 +30,108 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include "rcontainer.h"
+#include "rcontainer_user.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+// Lock page of the container the calling thread belongs to, mapped on its first lock.
+// Slots are cached by oid, each entry packs (oid << 8) | (slot + 1), or (oid << 8) | RCONTAINER_NO_SLOT for a lock
+// that got no slot; slots are not recycled, so it keeps going through the kernel.
+// Both are per thread: threads of one process can be in different containers, and only the thread that
+// owns the cache resets it, so a lookup never sees the page unmapped under it.
+#define RCONTAINER_SLOT_CACHE 256
+#define RCONTAINER_NO_SLOT 0xff
+static __thread struct resource_container_lock_slot *rcontainer_lock_page;
+static __thread __u64 rcontainer_slot_cache[RCONTAINER_SLOT_CACHE];
+
+/**
+ * Forget the lock page, the container of the calling thread changed.
+ */
+static void rcontainer_lock_page_reset(void)
+{
+    if (rcontainer_lock_page != NULL && rcontainer_lock_page != MAP_FAILED)
+        munmap(rcontainer_lock_page, getpagesize());
+    rcontainer_lock_page = NULL;
+    memset(rcontainer_slot_cache, 0, sizeof(rcontainer_slot_cache));
+}
+
+/**
+ * Find the lock slot of an oid in the lock page, NULL if the lock has to go through the kernel.
+ */
+static struct resource_container_lock_slot *rcontainer_lock_slot(int devfd, __u64 offset)
+{
+    struct resource_container_cmd cmd;
+    __u64 *entry = &rcontainer_slot_cache[offset % RCONTAINER_SLOT_CACHE];
+    int slot;
+
+    if (*entry != 0 && (*entry >> 8) == offset)
+        return ((*entry & 0xff) == RCONTAINER_NO_SLOT) ? NULL : &rcontainer_lock_page[(*entry & 0xff) - 1];
+    if (offset >= RCONTAINER_RESERVED_OFFSET)
+        return NULL;
+    if (rcontainer_lock_page == NULL)
+        rcontainer_lock_page = mmap(0, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, devfd, RCONTAINER_LOCK_PAGE_OFFSET * getpagesize());
+    if (rcontainer_lock_page == MAP_FAILED)
+        return NULL;
+    cmd.oid = offset;
+    slot = ioctl(devfd, RCONTAINER_IOCTL_LOCK_SLOT, &cmd);
+    if (slot < 0 && errno == ENOSPC)
+        *entry = (offset << 8) | RCONTAINER_NO_SLOT;
+    if (slot < 0)
+        return NULL;
+    *entry = (offset << 8) | (slot + 1);
+    return &rcontainer_lock_page[slot];
+}
+
+/**
+ * Bump the sequence counter of a lock held exclusively: odd once the lock is taken, even again before it is released.
+ */
+static void rcontainer_seq_begin(struct resource_container_lock_slot *slot)
+{
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void rcontainer_seq_end(struct resource_container_lock_slot *slot)
+{
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count an acquisition made without the kernel, reported by RCONTAINER_IOCTL_LOCK_STATS.
+ */
+static void rcontainer_count_acquire(struct resource_container_lock_slot *slot)
+{
+    __atomic_fetch_add(&slot->acquisitions, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Fail a call the user-space backend has no counterpart for, rather than send it to a devfd that is no device.
+ */
+static int rcontainer_user_unsupported(void)
+{
+    errno = ENOTTY;
+    return -1;
+}
+
+/**
+ * Open the device, or the shared state of the user-space backend when RCONTAINER_BACKEND=user
+ * (or the library is librcontainer_user). The result is the devfd of every other call.
+ */
+int rcontainer_open(void)
+{
+    if (rcontainer_user_backend())
+        return rcontainer_user_open();
+    return open("/dev/rcontainer", O_RDWR);
+}
 
 int rcontainer_delete(int devfd)
 {
     struct resource_container_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_delete();
+    rcontainer_lock_page_reset();
     return ioctl(devfd, RCONTAINER_IOCTL_DELETE, &cmd);
 }
 
@@ -44,52 +142,819 @@ int rcontainer_delete(int devfd)
 int rcontainer_create(int devfd, int cid)
 {
     struct resource_container_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_create(cid);
     cmd.cid = cid;
+    rcontainer_lock_page_reset();
     return ioctl(devfd, RCONTAINER_IOCTL_CREATE, &cmd);
 }
 
+/**
+ * Move the task tid (0 for the calling task) to the container cid without tearing down its state.
+ * The caller sleeps until its turn if it moves itself into a container that already has threads.
+ * Lock slots are cached per thread, so a task moved by another one must not take object locks until it
+ * calls rcontainer_migrate(devfd, 0, cid) itself, which only refreshes its cache.
+ */
+int rcontainer_migrate(int devfd, int tid, int cid)
+{
+    struct resource_container_migrate_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.tid = tid;
+    cmd.cid = cid;
+    cmd.flags = 0;
+    cmd.reserved = 0;
+    if (tid == 0)
+        rcontainer_lock_page_reset();
+    return ioctl(devfd, RCONTAINER_IOCTL_MIGRATE, &cmd);
+}
+
+/**
+ * Create or update count containers with their attributes in one call.
+ * Return the number of containers set up.
+ */
+int rcontainer_setup(int devfd, const struct resource_container_attr *attrs, int count)
+{
+    struct resource_container_setup_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.attrs = (__u64)(unsigned long)attrs;
+    cmd.count = count;
+    cmd.flags = 0;
+    return ioctl(devfd, RCONTAINER_IOCTL_SETUP, &cmd);
+}
+
+/**
+ * Remove count containers set up with rcontainer_setup, only the cid of each entry is used.
+ * The containers must have no threads left; their objects and locks are freed.
+ * Return the number of containers removed.
+ */
+int rcontainer_teardown(int devfd, const struct resource_container_attr *attrs, int count)
+{
+    struct resource_container_setup_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.attrs = (__u64)(unsigned long)attrs;
+    cmd.count = count;
+    cmd.flags = RCONTAINER_SETUP_REMOVE;
+    return ioctl(devfd, RCONTAINER_IOCTL_SETUP, &cmd);
+}
+
+/**
+ * Register count tasks (e.g. forked workers) in their containers on their behalf.
+ * Each task still calls rcontainer_create with its cid, which then only waits for its turn.
+ * Return the number of tasks registered.
+ */
+int rcontainer_register(int devfd, const struct resource_container_task *tasks, int count)
+{
+    struct resource_container_register_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.tasks = (__u64)(unsigned long)tasks;
+    cmd.count = count;
+    cmd.flags = 0;
+    return ioctl(devfd, RCONTAINER_IOCTL_REGISTER, &cmd);
+}
+
 /**
  * Allocate memory in kernel space for sharing along with tasks in the same container.
  */
 void *rcontainer_heap_alloc(int devfd, __u64 offset, __u64 size)
 {
     __u64 aligned_size = ((size + getpagesize() - 1) / getpagesize()) * getpagesize();
+    if (rcontainer_user_backend())
+        return rcontainer_user_heap_alloc(offset, size);
     return mmap(0, aligned_size, PROT_READ | PROT_WRITE, MAP_SHARED, devfd, offset * getpagesize());
 }
 
 /**
  * Lock a data item
+ * An uncontended lock is taken in user space, the kernel is only entered to sleep.
  */
 int rcontainer_lock(int devfd, __u64 offset)
 {
     struct resource_container_cmd cmd;
+    struct resource_container_lock_slot *slot;
+    __u32 expected = 0;
+
+    if (rcontainer_user_backend())
+        return rcontainer_user_lock(offset);
+    slot = rcontainer_lock_slot(devfd, offset);
+    if (slot != NULL && __atomic_compare_exchange_n(&slot->word, &expected, RCONTAINER_LOCK_HELD, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        rcontainer_seq_begin(slot);
+        rcontainer_count_acquire(slot);
+        return 0;
+    }
     cmd.oid = offset;
     return ioctl(devfd, RCONTAINER_IOCTL_LOCK, &cmd);
 }
 
 /**
- * Unlock a data item
+ * Lock a data item exclusively, same as rcontainer_lock.
+ */
+int rcontainer_wrlock(int devfd, __u64 offset)
+{
+    return rcontainer_lock(devfd, offset);
+}
+
+/**
+ * Lock a data item shared with other readers.
+ * Readers join in user space unless the item is held exclusively or an exclusive locker is waiting.
+ */
+int rcontainer_rdlock(int devfd, __u64 offset)
+{
+    struct resource_container_cmd cmd;
+    struct resource_container_lock_slot *slot;
+    __u32 old;
+
+    // the user-space backend has exclusive locks only, so its readers exclude each other
+    if (rcontainer_user_backend())
+        return rcontainer_user_lock(offset);
+    slot = rcontainer_lock_slot(devfd, offset);
+    if (slot != NULL)
+    {
+        old = __atomic_load_n(&slot->word, __ATOMIC_RELAXED);
+        while (!(old & (RCONTAINER_LOCK_HELD | RCONTAINER_LOCK_WRITER_WAITING)))
+        {
+            if (__atomic_compare_exchange_n(&slot->word, &old, old + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            {
+                rcontainer_count_acquire(slot);
+                return 0;
+            }
+        }
+    }
+    cmd.oid = offset;
+    return ioctl(devfd, RCONTAINER_IOCTL_RDLOCK, &cmd);
+}
+
+/**
+ * Take the lock of a data item only if it is free, fail with errno EAGAIN otherwise.
+ */
+static int rcontainer_trylock_mode(int devfd, __u64 offset, __u64 flags)
+{
+    struct resource_container_lock_cmd cmd;
+    struct resource_container_lock_slot *slot;
+    __u32 old;
+
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    slot = rcontainer_lock_slot(devfd, offset);
+    if (slot != NULL)
+    {
+        old = __atomic_load_n(&slot->word, __ATOMIC_RELAXED);
+        if (flags & RCONTAINER_LOCK_SHARED)
+        {
+            while (!(old & (RCONTAINER_LOCK_HELD | RCONTAINER_LOCK_WRITER_WAITING)))
+            {
+                if (__atomic_compare_exchange_n(&slot->word, &old, old + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                {
+                    rcontainer_count_acquire(slot);
+                    return 0;
+                }
+            }
+        }
+        else
+        {
+            while (!(old & (RCONTAINER_LOCK_HELD | RCONTAINER_LOCK_READERS)))
+            {
+                if (__atomic_compare_exchange_n(&slot->word, &old, old | RCONTAINER_LOCK_HELD, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                {
+                    rcontainer_seq_begin(slot);
+                    rcontainer_count_acquire(slot);
+                    return 0;
+                }
+            }
+        }
+        // the word is all there is to check, no need to ask the kernel again
+        errno = EAGAIN;
+        return -1;
+    }
+    cmd.oid = offset;
+    cmd.flags = flags;
+    return ioctl(devfd, RCONTAINER_IOCTL_TRYLOCK, &cmd);
+}
+
+/**
+ * Take the lock of a data item, waiting at most timeout_ns nanoseconds.
+ * Fails with errno ETIMEDOUT when the time is up and EINTR when a signal arrives.
+ */
+static int rcontainer_timedlock_mode(int devfd, __u64 offset, __u64 timeout_ns, __u64 flags)
+{
+    struct resource_container_lock_cmd cmd;
+
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    if (rcontainer_trylock_mode(devfd, offset, flags) == 0)
+        return 0;
+    cmd.oid = offset;
+    cmd.timeout_ns = timeout_ns;
+    cmd.flags = flags;
+    return ioctl(devfd, RCONTAINER_IOCTL_TIMEDLOCK, &cmd);
+}
+
+int rcontainer_trylock(int devfd, __u64 offset)
+{
+    return rcontainer_trylock_mode(devfd, offset, 0);
+}
+
+int rcontainer_tryrdlock(int devfd, __u64 offset)
+{
+    return rcontainer_trylock_mode(devfd, offset, RCONTAINER_LOCK_SHARED);
+}
+
+int rcontainer_timedlock(int devfd, __u64 offset, __u64 timeout_ns)
+{
+    return rcontainer_timedlock_mode(devfd, offset, timeout_ns, 0);
+}
+
+int rcontainer_timedrdlock(int devfd, __u64 offset, __u64 timeout_ns)
+{
+    return rcontainer_timedlock_mode(devfd, offset, timeout_ns, RCONTAINER_LOCK_SHARED);
+}
+
+/**
+ * Unlock a data item held exclusively or shared.
+ * The kernel is only entered when a waiter has to be woken up.
  */
 int rcontainer_unlock(int devfd, __u64 offset)
 {
     struct resource_container_cmd cmd;
+    struct resource_container_lock_slot *slot;
+    __u32 old;
+
+    if (rcontainer_user_backend())
+        return rcontainer_user_unlock(offset);
+    slot = rcontainer_lock_slot(devfd, offset);
+    if (slot != NULL)
+    {
+        old = __atomic_load_n(&slot->word, __ATOMIC_RELAXED);
+        // the kernel only bumps an odd sequence counter, so ending it here is right even if the release goes there
+        if (old & RCONTAINER_LOCK_HELD)
+            rcontainer_seq_end(slot);
+        while (!(old & RCONTAINER_LOCK_WAITERS))
+        {
+            if (__atomic_compare_exchange_n(&slot->word, &old, (old & RCONTAINER_LOCK_HELD) ? 0 : old - 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                return 0;
+        }
+    }
     cmd.oid = offset;
     return ioctl(devfd, RCONTAINER_IOCTL_UNLOCK, &cmd);
 }
 
+/**
+ * Start an optimistic read of a data item without taking its lock.
+ * Stores the sequence number to pass to rcontainer_read_retry in seq. If a writer keeps the item for long,
+ * or the item has no lock slot, the shared lock is taken instead and seq is odd.
+ * Returns 0, or -1 if the shared lock could not be taken; seq is then not set and no retry is needed.
+ *
+ *     do {
+ *         if (rcontainer_read_begin(devfd, offset, &seq))
+ *             return -1;
+ *         value = *object;
+ *     } while ((ret = rcontainer_read_retry(devfd, offset, seq)) > 0);
+ */
+int rcontainer_read_begin(int devfd, __u64 offset, __u32 *seq)
+{
+    struct resource_container_lock_slot *slot;
+    int spin;
+
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    slot = rcontainer_lock_slot(devfd, offset);
+    if (slot != NULL)
+    {
+        for (spin = 0; spin < 1000; spin++)
+        {
+            *seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            if (!(*seq & 1))
+                return 0;
+        }
+    }
+    if (rcontainer_rdlock(devfd, offset) < 0)
+        return -1;
+    *seq = 1;
+    return 0;
+}
+
+/**
+ * Finish an optimistic read. Returns 1 if a writer got in and the read has to be repeated, 0 if the read
+ * is good, or -1 if dropping the shared lock taken by rcontainer_read_begin failed.
+ */
+int rcontainer_read_retry(int devfd, __u64 offset, __u32 seq)
+{
+    struct resource_container_lock_slot *slot;
+
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    if (seq & 1)
+        return rcontainer_unlock(devfd, offset) < 0 ? -1 : 0;
+    slot = rcontainer_lock_slot(devfd, offset);
+    // the cache was reset since the read began, repeat it and let rcontainer_read_begin decide again
+    if (slot == NULL)
+        return 1;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/**
+ * Lock count data items in one call, all or nothing.
+ * The kernel takes them in ascending offset order, so the order of the array does not matter.
+ */
+static int rcontainer_multilock(int devfd, const __u64 *offsets, int count, __u32 flags)
+{
+    struct resource_container_multilock_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.oids = (__u64)(unsigned long)offsets;
+    cmd.count = count;
+    cmd.flags = flags;
+    return ioctl(devfd, RCONTAINER_IOCTL_MULTILOCK, &cmd);
+}
+
+int rcontainer_lock_many(int devfd, const __u64 *offsets, int count)
+{
+    return rcontainer_multilock(devfd, offsets, count, 0);
+}
+
+int rcontainer_rdlock_many(int devfd, const __u64 *offsets, int count)
+{
+    return rcontainer_multilock(devfd, offsets, count, RCONTAINER_LOCK_SHARED);
+}
+
+/**
+ * Lock count data items only if all of them are free, fail with errno EAGAIN otherwise.
+ */
+int rcontainer_trylock_many(int devfd, const __u64 *offsets, int count)
+{
+    return rcontainer_multilock(devfd, offsets, count, RCONTAINER_LOCK_TRY);
+}
+
+/**
+ * Unlock count data items.
+ */
+int rcontainer_unlock_many(int devfd, const __u64 *offsets, int count)
+{
+    struct resource_container_multilock_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.oids = (__u64)(unsigned long)offsets;
+    cmd.count = count;
+    cmd.flags = 0;
+    return ioctl(devfd, RCONTAINER_IOCTL_MULTIUNLOCK, &cmd);
+}
+
 /**
  * Invalidate the content of object.
  */
 int rcontainer_free(int devfd, __u64 offset)
 {
     struct resource_container_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_free(offset);
     cmd.oid = offset;
     return ioctl(devfd, RCONTAINER_IOCTL_FREE, &cmd);
 }
 
+/**
+ * Move an object to the container cid without copying its content.
+ */
+int rcontainer_transfer(int devfd, __u64 offset, int cid)
+{
+    struct resource_container_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.op = RCONTAINER_TRANSFER_MOVE;
+    cmd.cid = cid;
+    cmd.oid = offset;
+    return ioctl(devfd, RCONTAINER_IOCTL_TRANSFER, &cmd);
+}
+
+/**
+ * Give the container cid a read-only view of an object without copying its content.
+ */
+int rcontainer_share(int devfd, __u64 offset, int cid)
+{
+    struct resource_container_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.op = RCONTAINER_TRANSFER_SHARE;
+    cmd.cid = cid;
+    cmd.oid = offset;
+    return ioctl(devfd, RCONTAINER_IOCTL_TRANSFER, &cmd);
+}
+
+/**
+ * Create the object snapshot_offset as a copy-on-write snapshot of the object offset.
+ */
+int rcontainer_snapshot(int devfd, __u64 offset, __u64 snapshot_offset)
+{
+    struct resource_container_snapshot_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.oid = offset;
+    cmd.snapshot_oid = snapshot_offset;
+    return ioctl(devfd, RCONTAINER_IOCTL_SNAPSHOT, &cmd);
+}
+
+/**
+ * Create or reattach a persistent object backed by a tmpfs file in the module's persist_dir.
+ * It survives the process and a module reload, but not a reboot or a crash.
+ * Map it with rcontainer_heap_alloc afterwards; size 0 reattaches an existing object with its stored size.
+ */
+int rcontainer_attach(int devfd, __u64 offset, __u64 size, int create)
+{
+    struct resource_container_attach_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.oid = offset;
+    cmd.size = size;
+    cmd.flags = create ? RCONTAINER_ATTACH_CREATE : 0;
+    return ioctl(devfd, RCONTAINER_IOCTL_ATTACH, &cmd);
+}
+
+static int rcontainer_atomic(int devfd, struct resource_container_atomic_cmd *cmd, __u64 offset, __u64 word_offset, int size, int op, __u64 value)
+{
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd->oid = offset;
+    cmd->offset = word_offset;
+    cmd->op = op;
+    cmd->size = size;
+    cmd->value = value;
+    return ioctl(devfd, RCONTAINER_IOCTL_ATOMIC, cmd);
+}
+
+/**
+ * Atomically add value to the size (4 or 8) byte word at word_offset of an object.
+ * The update is done in the kernel without taking the object lock. The old value is stored in *old unless
+ * old is NULL. Return 0, or -1 with errno set on error.
+ */
+int rcontainer_fetch_add(int devfd, __u64 offset, __u64 word_offset, int size, __u64 value, __u64 *old)
+{
+    struct resource_container_atomic_cmd cmd;
+    if (rcontainer_atomic(devfd, &cmd, offset, word_offset, size, RCONTAINER_ATOMIC_ADD, value))
+        return -1;
+    if (old != NULL)
+        *old = cmd.result;
+    return 0;
+}
+
+/**
+ * Atomically store value in a word of an object, the old value goes to *old as in rcontainer_fetch_add.
+ */
+int rcontainer_xchg(int devfd, __u64 offset, __u64 word_offset, int size, __u64 value, __u64 *old)
+{
+    struct resource_container_atomic_cmd cmd;
+    if (rcontainer_atomic(devfd, &cmd, offset, word_offset, size, RCONTAINER_ATOMIC_XCHG, value))
+        return -1;
+    if (old != NULL)
+        *old = cmd.result;
+    return 0;
+}
+
+/**
+ * Store value in a word of an object if it still holds *expected.
+ * Return 1 if the word was replaced, 0 if not (*expected then gets the current value), -1 on error.
+ */
+int rcontainer_cmpxchg(int devfd, __u64 offset, __u64 word_offset, int size, __u64 *expected, __u64 value)
+{
+    struct resource_container_atomic_cmd cmd;
+    cmd.expected = *expected;
+    if (rcontainer_atomic(devfd, &cmd, offset, word_offset, size, RCONTAINER_ATOMIC_CMPXCHG, value))
+        return -1;
+    if (cmd.result == *expected)
+        return 1;
+    *expected = cmd.result;
+    return 0;
+}
+
+/**
+ * Run count atomic operations in one system call. Each result field gets the old value of its word.
+ * Return the number of operations done; they stop at the first failing one.
+ */
+int rcontainer_atomic_batch(int devfd, struct resource_container_atomic_cmd *ops, int count)
+{
+    struct resource_container_atomic_batch cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.ops = (__u64)(unsigned long)ops;
+    cmd.count = count;
+    cmd.flags = 0;
+    return ioctl(devfd, RCONTAINER_IOCTL_ATOMIC_BATCH, &cmd);
+}
+
+/**
+ * Return the current notification version of an object.
+ */
+__u32 rcontainer_version(int devfd, __u64 offset)
+{
+    struct resource_container_wait_cmd cmd;
+    if (rcontainer_user_backend())
+        return 0;
+    cmd.oid = offset;
+    cmd.version = 0;
+    cmd.flags = RCONTAINER_WAIT_NONBLOCK;
+    ioctl(devfd, RCONTAINER_IOCTL_WAIT, &cmd);
+    return cmd.version;
+}
+
+/**
+ * Sleep until the object is notified after the version in *version was seen.
+ * *version gets the new version. Check the condition in the object before calling again.
+ */
+int rcontainer_wait(int devfd, __u64 offset, __u32 *version)
+{
+    struct resource_container_wait_cmd cmd;
+    int ret;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.oid = offset;
+    cmd.version = *version;
+    cmd.flags = 0;
+    ret = ioctl(devfd, RCONTAINER_IOCTL_WAIT, &cmd);
+    *version = cmd.version;
+    return ret;
+}
+
+/**
+ * Arm devfd so that poll()/epoll report it readable once the object is notified after *version.
+ * epoll keeps watching the object armed when devfd was added to it; re-add devfd after arming another object.
+ * Return 0 if it already was (*version gets the new version), -1 with errno EAGAIN when armed.
+ */
+int rcontainer_wait_poll(int devfd, __u64 offset, __u32 *version)
+{
+    struct resource_container_wait_cmd cmd;
+    int ret;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.oid = offset;
+    cmd.version = *version;
+    cmd.flags = RCONTAINER_WAIT_POLL;
+    ret = ioctl(devfd, RCONTAINER_IOCTL_WAIT, &cmd);
+    *version = cmd.version;
+    return ret;
+}
+
+/**
+ * Wake count waiters of an object, or all of them when count is 0.
+ */
+int rcontainer_notify(int devfd, __u64 offset, int count)
+{
+    struct resource_container_notify_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.oid = offset;
+    cmd.count = count;
+    return ioctl(devfd, RCONTAINER_IOCTL_NOTIFY, &cmd);
+}
+
+/**
+ * Read the contention counters of the lock of an object into stats.
+ */
+int rcontainer_lock_stats(int devfd, __u64 offset, struct resource_container_lock_stats *stats)
+{
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    stats->oid = offset;
+    return ioctl(devfd, RCONTAINER_IOCTL_LOCK_STATS, stats);
+}
+
+/**
+ * Run count commands (lock, unlock, free, atomics, notify) in one kernel entry, in order.
+ * Every entry gets its result; entries after the first failure are not run and get -ECANCELED, except unlocks
+ * of locks taken earlier in the same batch, which still run so those locks are released.
+ * Return the number of entries that succeeded before the first failure.
+ */
+int rcontainer_batch(int devfd, struct resource_container_batch_entry *entries, int count)
+{
+    struct resource_container_batch_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.entries = (__u64)(unsigned long)entries;
+    cmd.count = count;
+    cmd.flags = 0;
+    return ioctl(devfd, RCONTAINER_IOCTL_BATCH, &cmd);
+}
+
+/**
+ * Unlock a data item and wake count waiters of it (0 wakes all) with a single system call.
+ */
+int rcontainer_unlock_notify(int devfd, __u64 offset, int count)
+{
+    struct resource_container_batch_entry entries[2] = {
+        { .op = RCONTAINER_OP_UNLOCK, .oid = offset },
+        { .op = RCONTAINER_OP_NOTIFY, .oid = offset, .arg = count },
+    };
+    int done = rcontainer_batch(devfd, entries, 2);
+    if (done == 2)
+        return 0;
+    if (done >= 0)
+        errno = -entries[done].result;
+    return -1;
+}
+
+/**
+ * Set up and map the submission and completion rings of devfd, entries (a power of two) in each.
+ */
+int rcontainer_ring_init(int devfd, struct rcontainer_ring *ring, __u32 entries)
+{
+    struct resource_container_ring_setup cmd;
+    void *mapping;
+
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.entries = entries;
+    cmd.flags = 0;
+    if (ioctl(devfd, RCONTAINER_IOCTL_RING_SETUP, &cmd))
+        return -1;
+    mapping = mmap(NULL, cmd.size, PROT_READ | PROT_WRITE, MAP_SHARED, devfd,
+                   RCONTAINER_RING_OFFSET * sysconf(_SC_PAGE_SIZE));
+    if (mapping == MAP_FAILED)
+        return -1;
+    ring->devfd = devfd;
+    ring->header = mapping;
+    ring->sqes = (void *)((char *)mapping + ring->header->sq_offset);
+    ring->cqes = (void *)((char *)mapping + ring->header->cq_offset);
+    ring->mask = ring->header->entries - 1;
+    ring->sq_tail = 0;
+    ring->size = cmd.size;
+    return 0;
+}
+
+/**
+ * Return the next free submission, NULL if the ring is full. Fill it and call rcontainer_ring_submit.
+ */
+struct resource_container_ring_sqe *rcontainer_ring_get_sqe(struct rcontainer_ring *ring)
+{
+    __u32 head = __atomic_load_n(&ring->header->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_tail - head > ring->mask)
+        return NULL;
+    return &ring->sqes[ring->sq_tail++ & ring->mask];
+}
+
+/**
+ * Publish the submissions filled since the last call and have the kernel run them.
+ * Return the number of submissions the kernel consumed.
+ */
+int rcontainer_ring_submit(struct rcontainer_ring *ring)
+{
+    struct resource_container_ring_enter cmd;
+    __atomic_store_n(&ring->header->sq_tail, ring->sq_tail, __ATOMIC_RELEASE);
+    cmd.to_submit = 0;
+    cmd.flags = 0;
+    return ioctl(ring->devfd, RCONTAINER_IOCTL_RING_ENTER, &cmd);
+}
+
+/**
+ * Return the oldest unread completion, NULL if there is none. Release it with rcontainer_ring_cqe_seen.
+ */
+struct resource_container_ring_cqe *rcontainer_ring_peek_cqe(struct rcontainer_ring *ring)
+{
+    __u32 head = ring->header->cq_head;
+    if (head == __atomic_load_n(&ring->header->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & ring->mask];
+}
+
+void rcontainer_ring_cqe_seen(struct rcontainer_ring *ring)
+{
+    __atomic_store_n(&ring->header->cq_head, ring->header->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Make read, write, splice and copy_file_range on devfd work on the data of an object, from its start.
+ * Use a device fd of its own for it, the selection and the file offset belong to the fd.
+ */
+int rcontainer_select(int devfd, __u64 offset)
+{
+    struct resource_container_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.oid = offset;
+    if (ioctl(devfd, RCONTAINER_IOCTL_SELECT, &cmd))
+        return -1;
+    return lseek(devfd, 0, SEEK_SET) < 0 ? -1 : 0;
+}
+
+/**
+ * Write the objects of the calling thread's container to fd at its current offset.
+ * With incremental set, only the pages written since the previous checkpoint are written.
+ * Returns the number of objects, bytes (if not NULL) gets the length of the stream.
+ */
+int rcontainer_checkpoint(int devfd, int fd, int incremental, __u64 *bytes)
+{
+    struct resource_container_checkpoint_cmd cmd;
+    int ret;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.fd = fd;
+    cmd.flags = incremental ? RCONTAINER_CHECKPOINT_INCREMENTAL : 0;
+    cmd.bytes = 0;
+    ret = ioctl(devfd, RCONTAINER_IOCTL_CHECKPOINT, &cmd);
+    if (ret >= 0 && bytes != NULL)
+        *bytes = cmd.bytes;
+    return ret;
+}
+
+/**
+ * Restore a checkpoint from fd, which must be seekable and stay unchanged while the restored objects live:
+ * their pages are read from it on first use.
+ */
+int rcontainer_restore(int devfd, int fd)
+{
+    struct resource_container_checkpoint_cmd cmd;
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    cmd.fd = fd;
+    cmd.flags = 0;
+    cmd.bytes = 0;
+    return ioctl(devfd, RCONTAINER_IOCTL_RESTORE, &cmd);
+}
+
+/**
+ * Read the CPU time and scheduling statistics of container cid into stats.
+ * Up to count entries of threads (may be NULL) get the statistics of its threads;
+ * stats->count says how many were filled, stats->nr_threads how many the container has.
+ */
+int rcontainer_stats(int devfd, int cid, struct resource_container_stats *stats,
+                     struct resource_container_thread_stats *threads, int count)
+{
+    int nr_threads;
+
+    if (rcontainer_user_backend())
+    {
+        // the user-space backend only keeps track of the threads
+        nr_threads = rcontainer_user_nr_threads(cid);
+        memset(stats, 0, sizeof(*stats));
+        stats->cid = cid;
+        stats->nr_threads = (nr_threads > 0) ? nr_threads : 0;
+        return (nr_threads < 0) ? -1 : 0;
+    }
+    stats->cid = cid;
+    stats->count = (threads != NULL) ? count : 0;
+    stats->threads = (__u64)(unsigned long)threads;
+    return ioctl(devfd, RCONTAINER_IOCTL_STATS, stats);
+}
+
+/**
+ * Read the latency histogram of op (RCONTAINER_LAT_*) into hist, and clear it if reset is set (CAP_SYS_ADMIN only).
+ */
+int rcontainer_latency(int devfd, int op, struct resource_container_latency *hist, int reset)
+{
+    if (rcontainer_user_backend())
+        return rcontainer_user_unsupported();
+    hist->op = op;
+    hist->flags = reset ? RCONTAINER_LATENCY_RESET : 0;
+    return ioctl(devfd, RCONTAINER_IOCTL_LATENCY, hist);
+}
+
+/**
+ * Latency in ns under which permille thousandths (500 for p50, 999 for p999) of the operations in hist
+ * completed, rounded up to the end of its bucket. 0 for an empty histogram. The debugfs latency file uses
+ * the same computation.
+ */
+__u64 rcontainer_latency_percentile(const struct resource_container_latency *hist, int permille)
+{
+    return rcontainer_latency_bucket_percentile(hist->buckets, hist->count, permille);
+}
+
 int rcontainer_context_switch_handler(int devfd, int id)
 {
      struct resource_container_cmd cmd;
+     if (rcontainer_user_backend())
+         return rcontainer_user_switch();
      cmd.cid = id;
-     return ioctl(DEVFD, RCONTAINER_IOCTL_CSWITCH, &cmd);
+     // the timer handler passes 0 and relies on the devfd given to rcontainer_init
+     return ioctl(devfd ? devfd : DEVFD, RCONTAINER_IOCTL_CSWITCH, &cmd);
+}
+
+int DEVFD;
+static void handler(int sig, siginfo_t *si, void *unused) {
+    int devfd;
+    int cid;
+//    fprintf(stderr,"sigalarm\n");
+    rcontainer_context_switch_handler(0, 0);
+}
+
+int rcontainer_init(int devfd)
+{
+    struct sigaction sa;
+    struct itimerval timeout;
+    
+    sa.sa_flags = SA_SIGINFO|SA_RESTART|SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = handler;
+    if (sigaction(SIGPROF, &sa, NULL) == -1) {
+        fprintf(stderr,"sigaction");
+        exit(1);
+    }
+    
+    DEVFD=devfd;
+    timeout.it_value.tv_sec = 0;
+    timeout.it_value.tv_usec = 5;
+    timeout.it_interval = timeout.it_value;
+    if(setitimer(ITIMER_PROF, &timeout, NULL)==1)
+        fprintf(stderr,"Timer failed\n");
+    return 0;
 }
@@ -44,45 +44,74 @@ extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 
+int rcontainer_open(void);
 int rcontainer_delete(int devfd);
 int rcontainer_create(int devfd, int cid);
+int rcontainer_migrate(int devfd, int tid, int cid);
+int rcontainer_setup(int devfd, const struct resource_container_attr *attrs, int count);
+int rcontainer_teardown(int devfd, const struct resource_container_attr *attrs, int count);
+int rcontainer_register(int devfd, const struct resource_container_task *tasks, int count);
 //int rcontainer_context_switch_handler(int devfd, int cid);
 int rcontainer_context_switch_handler(int devfd, int cid);
 int rcontainer_init(int devfd);
 void *rcontainer_heap_alloc(int devfd, __u64 offset, __u64 size);
 int rcontainer_lock(int devfd, __u64 offset);
 int rcontainer_unlock(int devfd, __u64 offset);
+int rcontainer_rdlock(int devfd, __u64 offset);
+int rcontainer_wrlock(int devfd, __u64 offset);
+int rcontainer_trylock(int devfd, __u64 offset);
+int rcontainer_tryrdlock(int devfd, __u64 offset);
+int rcontainer_timedlock(int devfd, __u64 offset, __u64 timeout_ns);
+int rcontainer_timedrdlock(int devfd, __u64 offset, __u64 timeout_ns);
+int rcontainer_read_begin(int devfd, __u64 offset, __u32 *seq);
+int rcontainer_read_retry(int devfd, __u64 offset, __u32 seq);
+int rcontainer_lock_many(int devfd, const __u64 *offsets, int count);
+int rcontainer_rdlock_many(int devfd, const __u64 *offsets, int count);
+int rcontainer_trylock_many(int devfd, const __u64 *offsets, int count);
+int rcontainer_unlock_many(int devfd, const __u64 *offsets, int count);
 int rcontainer_free(int devfd, __u64 offset);
-    
-int DEVFD;
-static void handler(int sig, siginfo_t *si, void *unused) {
-    int devfd;
-    int cid;
-//    fprintf(stderr,"sigalarm\n");
-    rcontainer_context_switch_handler(0, 0);
-}
+int rcontainer_transfer(int devfd, __u64 offset, int cid);
+int rcontainer_share(int devfd, __u64 offset, int cid);
+int rcontainer_snapshot(int devfd, __u64 offset, __u64 snapshot_offset);
+int rcontainer_attach(int devfd, __u64 offset, __u64 size, int create);
+int rcontainer_select(int devfd, __u64 offset);
+int rcontainer_checkpoint(int devfd, int fd, int incremental, __u64 *bytes);
+int rcontainer_restore(int devfd, int fd);
+int rcontainer_stats(int devfd, int cid, struct resource_container_stats *stats,
+                     struct resource_container_thread_stats *threads, int count);
+int rcontainer_latency(int devfd, int op, struct resource_container_latency *hist, int reset);
+__u64 rcontainer_latency_percentile(const struct resource_container_latency *hist, int permille);
+int rcontainer_fetch_add(int devfd, __u64 offset, __u64 word_offset, int size, __u64 value, __u64 *old);
+int rcontainer_xchg(int devfd, __u64 offset, __u64 word_offset, int size, __u64 value, __u64 *old);
+int rcontainer_cmpxchg(int devfd, __u64 offset, __u64 word_offset, int size, __u64 *expected, __u64 value);
+int rcontainer_atomic_batch(int devfd, struct resource_container_atomic_cmd *ops, int count);
+__u32 rcontainer_version(int devfd, __u64 offset);
+int rcontainer_wait(int devfd, __u64 offset, __u32 *version);
+int rcontainer_wait_poll(int devfd, __u64 offset, __u32 *version);
+int rcontainer_notify(int devfd, __u64 offset, int count);
+int rcontainer_lock_stats(int devfd, __u64 offset, struct resource_container_lock_stats *stats);
+int rcontainer_batch(int devfd, struct resource_container_batch_entry *entries, int count);
+int rcontainer_unlock_notify(int devfd, __u64 offset, int count);
 
-int rcontainer_init(int devfd)
+// submission/completion rings of a device fd, see struct resource_container_ring_header
+struct rcontainer_ring
 {
-    struct sigaction sa;
-    struct itimerval timeout;
-    
-    sa.sa_flags = SA_SIGINFO|SA_RESTART|SA_ONSTACK;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_sigaction = handler;
-    if (sigaction(SIGPROF, &sa, NULL) == -1) {
-        fprintf(stderr,"sigaction");
-        exit(1);
-    }
-    
-    DEVFD=devfd;
-    timeout.it_value.tv_sec = 0;
-    timeout.it_value.tv_usec = 5;
-    timeout.it_interval = timeout.it_value;
-    if(setitimer(ITIMER_PROF, &timeout, NULL)==1)
-        fprintf(stderr,"Timer failed\n");
-    return 0;
-}
+    int devfd;
+    struct resource_container_ring_header *header;
+    struct resource_container_ring_sqe *sqes;
+    struct resource_container_ring_cqe *cqes;
+    __u32 mask;
+    __u32 sq_tail;      // submissions handed out by rcontainer_ring_get_sqe, published by rcontainer_ring_submit
+    size_t size;
+};
+int rcontainer_ring_init(int devfd, struct rcontainer_ring *ring, __u32 entries);
+struct resource_container_ring_sqe *rcontainer_ring_get_sqe(struct rcontainer_ring *ring);
+int rcontainer_ring_submit(struct rcontainer_ring *ring);
+struct resource_container_ring_cqe *rcontainer_ring_peek_cqe(struct rcontainer_ring *ring);
+void rcontainer_ring_cqe_seen(struct rcontainer_ring *ring);
+
+// device fd the SIGPROF timer of rcontainer_init switches on
+extern int DEVFD;
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,333 @@
+//////////////////////////////////////////////////////////////////////
+//                      University of California, Riverside
+//
+//
+//
+//                             Copyright 2021
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     C++20 RAII wrapper of CSE202's Resource Container library
+//
+//   Container is the membership of the calling thread in a container, it
+//   deletes the membership and unmaps every object when it goes away.
+//   SharedObject<T> maps an object once per container session and unmaps
+//   it with the last handle. LockGuard and SharedLockGuard release the
+//   object lock at the end of the scope; a guard nested in a guard of the
+//   same object is a no-op instead of a second lock call.
+//
+//   A Container belongs to the thread that created it, like the membership
+//   it stands for. Objects and guards share its session; once the Container
+//   is gone they stay safe to destroy, but their data must not be used and
+//   new guards throw. Errors are reported with std::system_error.
+//
+////////////////////////////////////////////////////////////////////////
+
+#ifndef RCONTAINER_HPP
+#define RCONTAINER_HPP
+
+#include "rcontainer.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace rcontainer
+{
+
+[[noreturn]] inline void throw_errno(const char *what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+namespace detail
+{
+
+// State of one container session. Shared by the Container and its objects and guards, so it
+// outlives a Container that is moved or destroyed first; active is false once the Container left.
+struct Session
+{
+    struct Mapping
+    {
+        void *address;
+        std::size_t size;
+        int handles;
+    };
+
+    struct Hold
+    {
+        int depth;
+        bool exclusive;
+    };
+
+    int devfd;
+    bool active = true;
+    std::unordered_map<__u64, Mapping> mappings;
+    std::unordered_map<__u64, Hold> holds;
+
+    // map object oid with at least size bytes, reusing the mapping of another handle
+    void *map(__u64 oid, std::size_t size)
+    {
+        if (!active)
+            throw std::logic_error("rcontainer: the container was left");
+        auto it = mappings.find(oid);
+        if (it != mappings.end() && it->second.size >= size)
+        {
+            it->second.handles++;
+            return it->second.address;
+        }
+        if (it != mappings.end())
+            throw std::length_error("rcontainer: object is mapped with a smaller size");
+        void *address = rcontainer_heap_alloc(devfd, oid, size);
+        if (address == MAP_FAILED)
+            throw_errno("rcontainer_heap_alloc");
+        mappings.emplace(oid, Mapping{address, size, 1});
+        return address;
+    }
+
+    void unmap(__u64 oid) noexcept
+    {
+        if (!active)
+            return;
+        auto it = mappings.find(oid);
+        if (it == mappings.end() || --it->second.handles > 0)
+            return;
+        munmap(it->second.address, it->second.size);
+        mappings.erase(it);
+    }
+
+    // take the lock of oid unless this session already holds it
+    void lock(__u64 oid, bool exclusive)
+    {
+        if (!active)
+            throw std::logic_error("rcontainer: the container was left");
+        auto it = holds.find(oid);
+        if (it != holds.end())
+        {
+            if (exclusive && !it->second.exclusive)
+                throw std::logic_error("rcontainer: cannot upgrade a shared lock");
+            it->second.depth++;
+            return;
+        }
+        if ((exclusive ? rcontainer_lock(devfd, oid) : rcontainer_rdlock(devfd, oid)) != 0)
+            throw_errno(exclusive ? "rcontainer_lock" : "rcontainer_rdlock");
+        holds.emplace(oid, Hold{1, exclusive});
+    }
+
+    void unlock(__u64 oid) noexcept
+    {
+        if (!active)
+            return;
+        auto it = holds.find(oid);
+        if (it == holds.end() || --it->second.depth > 0)
+            return;
+        holds.erase(it);
+        rcontainer_unlock(devfd, oid);
+    }
+};
+
+} // namespace detail
+
+class Container
+{
+public:
+    // join container cid on the device devfd
+    Container(int devfd, int cid) : session_(std::make_shared<detail::Session>())
+    {
+        session_->devfd = devfd;
+        if (rcontainer_create(devfd, cid) != 0)
+            throw_errno("rcontainer_create");
+    }
+
+    Container(const Container &) = delete;
+    Container &operator=(const Container &) = delete;
+    Container(Container &&) noexcept = default;
+
+    Container &operator=(Container &&other) noexcept
+    {
+        if (this != &other)
+        {
+            leave();
+            session_ = std::move(other.session_);
+        }
+        return *this;
+    }
+
+    ~Container() { leave(); }
+
+    int fd() const { return session()->devfd; }
+
+    // move the calling thread to container cid, keeping its mappings
+    void migrate(int cid)
+    {
+        if (rcontainer_migrate(session()->devfd, 0, cid) != 0)
+            throw_errno("rcontainer_migrate");
+    }
+
+    // the session of the container, a moved-from container has none left
+    const std::shared_ptr<detail::Session> &session() const
+    {
+        if (!session_)
+            throw std::logic_error("rcontainer: the container was moved from");
+        return session_;
+    }
+
+private:
+    void leave() noexcept
+    {
+        if (!session_)
+            return;
+        for (auto &[oid, hold] : session_->holds)
+            rcontainer_unlock(session_->devfd, oid);
+        for (auto &[oid, mapping] : session_->mappings)
+            munmap(mapping.address, mapping.size);
+        session_->holds.clear();
+        session_->mappings.clear();
+        session_->active = false;
+        rcontainer_delete(session_->devfd);
+        session_.reset();
+    }
+
+    std::shared_ptr<detail::Session> session_;
+};
+
+// exclusive lock of an object for the rest of the scope
+class LockGuard
+{
+public:
+    LockGuard(Container &container, __u64 oid) : LockGuard(container.session(), oid) {}
+
+    LockGuard(std::shared_ptr<detail::Session> session, __u64 oid) : session_(std::move(session)), oid_(oid)
+    {
+        session_->lock(oid_, true);
+    }
+
+    LockGuard(const LockGuard &) = delete;
+    LockGuard &operator=(const LockGuard &) = delete;
+    LockGuard(LockGuard &&other) noexcept : session_(std::move(other.session_)), oid_(other.oid_) {}
+    LockGuard &operator=(LockGuard &&) = delete;
+
+    ~LockGuard()
+    {
+        if (session_)
+            session_->unlock(oid_);
+    }
+
+private:
+    std::shared_ptr<detail::Session> session_;
+    __u64 oid_;
+};
+
+// shared lock of an object for the rest of the scope
+class SharedLockGuard
+{
+public:
+    SharedLockGuard(Container &container, __u64 oid) : SharedLockGuard(container.session(), oid) {}
+
+    SharedLockGuard(std::shared_ptr<detail::Session> session, __u64 oid) : session_(std::move(session)), oid_(oid)
+    {
+        session_->lock(oid_, false);
+    }
+
+    SharedLockGuard(const SharedLockGuard &) = delete;
+    SharedLockGuard &operator=(const SharedLockGuard &) = delete;
+    SharedLockGuard(SharedLockGuard &&other) noexcept : session_(std::move(other.session_)), oid_(other.oid_) {}
+    SharedLockGuard &operator=(SharedLockGuard &&) = delete;
+
+    ~SharedLockGuard()
+    {
+        if (session_)
+            session_->unlock(oid_);
+    }
+
+private:
+    std::shared_ptr<detail::Session> session_;
+    __u64 oid_;
+};
+
+// object oid of the container viewed as count elements of T
+template <typename T>
+class SharedObject
+{
+    static_assert(std::is_trivially_copyable_v<T>, "objects are shared memory, T must be trivially copyable");
+
+public:
+    SharedObject(Container &container, __u64 oid, std::size_t count = 1)
+        : session_(container.session()), oid_(oid), count_(count),
+          data_(static_cast<T *>(session_->map(oid, count * sizeof(T))))
+    {
+    }
+
+    SharedObject(const SharedObject &) = delete;
+    SharedObject &operator=(const SharedObject &) = delete;
+
+    SharedObject(SharedObject &&other) noexcept
+        : session_(std::move(other.session_)), oid_(other.oid_), count_(other.count_), data_(other.data_)
+    {
+    }
+
+    SharedObject &operator=(SharedObject &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            session_ = std::move(other.session_);
+            oid_ = other.oid_;
+            count_ = other.count_;
+            data_ = other.data_;
+        }
+        return *this;
+    }
+
+    ~SharedObject() { release(); }
+
+    T *get() const noexcept { return data_; }
+    T &operator*() const noexcept { return *data_; }
+    T *operator->() const noexcept { return data_; }
+    T &operator[](std::size_t i) const noexcept { return data_[i]; }
+    std::span<T> span() const noexcept { return {data_, count_}; }
+    std::size_t size() const noexcept { return count_; }
+    __u64 oid() const noexcept { return oid_; }
+
+    [[nodiscard]] LockGuard lock() const { return LockGuard(session_, oid_); }
+    [[nodiscard]] SharedLockGuard lock_shared() const { return SharedLockGuard(session_, oid_); }
+
+private:
+    void release() noexcept
+    {
+        if (session_)
+            session_->unmap(oid_);
+        session_.reset();
+    }
+
+    std::shared_ptr<detail::Session> session_;
+    __u64 oid_;
+    std::size_t count_;
+    T *data_;
+};
+
+} // namespace rcontainer
+
+#endif
@@ -0,0 +1,637 @@
+//////////////////////////////////////////////////////////////////////
+//                     University of California, Riverside
+//
+//
+//
+//                             Copyright 2021
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     User-space backend of CSE202's Resource Container library, so
+//     programs run without the kernel module and without root.
+//
+//   The containers, threads, objects and locks of ioctl.c live in a shared
+//   memory segment (RCONTAINER_SHM, default /rcontainer-<uid>) guarded by
+//   one futex mutex, the counterpart of mlock. Objects are shared memory
+//   files of their own, locks are futex words in the segment.
+//
+//   Scheduling follows ioctl.c: the first thread of a container gets the
+//   turn, the others sleep in create until the switch hands it to them, and
+//   every switch rotates the turn of the next container. A task cannot put
+//   another one to sleep from user space, so the one that lost its turn
+//   parks itself on its next switch tick or lock wait.
+//
+//   Only create, delete, switch, lock, unlock, heap_alloc, free and the
+//   thread count of stats are implemented; other calls fail with ENOTTY.
+//   Tasks that died without delete are dropped on the next create.
+//
+////////////////////////////////////////////////////////////////////////
+
+#include "rcontainer_user.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define USER_MAX_CONTAINERS 1024
+#define USER_MAX_THREADS    4096
+#define USER_MAX_OBJECTS    4096
+#define USER_MAX_LOCKS      4096
+#define USER_MAX_USERS      32      // tasks recorded per object, like the tid list of a memory block
+#define USER_LOCK_TICK_NS   1000000 // a lock waiter runs the switch this often, it gets no timer ticks while asleep
+
+struct user_container
+{
+    int used;
+    int cid;
+    int running;        // thread slot that has the turn, -1 if none
+};
+
+struct user_thread
+{
+    int used;
+    int tid;
+    int container;      // container slot
+    __u32 turn;         // 1 while the thread has the turn, the thread sleeps on it otherwise
+    __u64 seq;          // order of arrival, the turn goes around in this order
+};
+
+struct user_object
+{
+    int used;
+    int container;
+    __u64 oid;
+    __u64 size;
+    int nr_users;
+    int users[USER_MAX_USERS];
+};
+
+struct user_lock
+{
+    int used;
+    int container;
+    __u64 oid;
+    __u32 word;         // 0 free, 1 held, 2 held with waiters
+};
+
+struct user_state
+{
+    __u32 mutex;        // same states as user_lock.word
+    int switch_target;  // container slot the next switch starts looking from
+    __u64 seq;
+    struct user_container containers[USER_MAX_CONTAINERS];
+    struct user_thread threads[USER_MAX_THREADS];
+    struct user_object objects[USER_MAX_OBJECTS];
+    struct user_lock locks[USER_MAX_LOCKS];
+};
+
+static struct user_state *state;
+static char state_name[NAME_MAX - 32];     // leaves room for the object names built on it
+static __thread int in_backend;     // set while the thread holds state->mutex, the switch signal must not take it again
+
+static long futex(__u32 *word, int op, __u32 value, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+static int gettid_(void)
+{
+    return (int)syscall(SYS_gettid);
+}
+
+/**
+ * Take a futex word: 0 free, 1 held, 2 held and someone may sleep on it.
+ * With tick set the sleep is cut short now and then to run the switch, as a waiter gets no timer signal.
+ */
+static void word_lock(__u32 *word, int tick)
+{
+    struct timespec timeout = {0, USER_LOCK_TICK_NS};
+    __u32 c = 0;
+
+    if (__atomic_compare_exchange_n(word, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    if (c != 2)
+        c = __atomic_exchange_n(word, 2, __ATOMIC_ACQUIRE);
+    while (c != 0)
+    {
+        if (futex(word, FUTEX_WAIT, 2, tick ? &timeout : NULL) != 0 && errno == ETIMEDOUT && tick)
+            rcontainer_user_switch();
+        c = __atomic_exchange_n(word, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void word_unlock(__u32 *word)
+{
+    if (__atomic_exchange_n(word, 0, __ATOMIC_RELEASE) == 2)
+        futex(word, FUTEX_WAKE, 1, NULL);
+}
+
+/**
+ * Map the shared segment, creating it on first use. A new segment is all zeroes, which is an empty state.
+ */
+static int state_attach(void)
+{
+    struct user_state *mapped, *none = NULL;
+    const char *name = getenv("RCONTAINER_SHM");
+    int fd;
+
+    if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != NULL)
+        return 0;
+    if (name != NULL)
+        snprintf(state_name, sizeof(state_name), "%s", name);
+    else
+        snprintf(state_name, sizeof(state_name), "/rcontainer-%d", (int)getuid());
+    fd = shm_open(state_name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, sizeof(struct user_state)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    mapped = mmap(0, sizeof(struct user_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return -1;
+    // another thread of the process may have mapped it meanwhile
+    if (!__atomic_compare_exchange_n(&state, &none, mapped, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        munmap(mapped, sizeof(struct user_state));
+    return 0;
+}
+
+static void state_lock(void)
+{
+    in_backend = 1;
+    word_lock(&state->mutex, 0);
+}
+
+static void state_unlock(void)
+{
+    word_unlock(&state->mutex);
+    in_backend = 0;
+}
+
+static int find_container(int cid)
+{
+    int i;
+    for (i = 0; i < USER_MAX_CONTAINERS; i++)
+        if (state->containers[i].used && state->containers[i].cid == cid)
+            return i;
+    return -1;
+}
+
+static int find_thread(int tid)
+{
+    int i;
+    for (i = 0; i < USER_MAX_THREADS; i++)
+        if (state->threads[i].used && state->threads[i].tid == tid)
+            return i;
+    return -1;
+}
+
+/**
+ * Container slot of the calling thread, -1 with errno EINVAL if it is in none.
+ */
+static int current_container(void)
+{
+    int t = find_thread(gettid_());
+    if (t < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return state->threads[t].container;
+}
+
+/**
+ * The thread after t in its container, wrapping around to the first one. t itself if it is alone.
+ */
+static int thread_next(int t)
+{
+    struct user_thread *threads = state->threads;
+    int i, next = -1, first = t;
+
+    for (i = 0; i < USER_MAX_THREADS; i++)
+    {
+        if (!threads[i].used || threads[i].container != threads[t].container)
+            continue;
+        if (threads[i].seq > threads[t].seq && (next < 0 || threads[i].seq < threads[next].seq))
+            next = i;
+        if (threads[i].seq < threads[first].seq)
+            first = i;
+    }
+    return (next >= 0) ? next : first;
+}
+
+static void give_turn(int c, int t)
+{
+    state->containers[c].running = t;
+    if (t >= 0)
+    {
+        __atomic_store_n(&state->threads[t].turn, 1, __ATOMIC_RELEASE);
+        futex(&state->threads[t].turn, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+/**
+ * Sleep until thread slot t has the turn. Called without the mutex.
+ */
+static void wait_turn(int t)
+{
+    while (__atomic_load_n(&state->threads[t].turn, __ATOMIC_ACQUIRE) == 0)
+        futex(&state->threads[t].turn, FUTEX_WAIT, 0, NULL);
+}
+
+static void object_name(char *name, size_t size, int c, __u64 oid)
+{
+    snprintf(name, size, "%s.%d.%llu", state_name, state->containers[c].cid, (unsigned long long)oid);
+}
+
+static void object_destroy(int o)
+{
+    char name[NAME_MAX];
+    object_name(name, sizeof(name), state->objects[o].container, state->objects[o].oid);
+    shm_unlink(name);
+    state->objects[o].used = 0;
+}
+
+/**
+ * Drop a container that has no thread left with its locks and objects, mappings keep the data alive.
+ */
+static void container_destroy(int c)
+{
+    int i;
+    for (i = 0; i < USER_MAX_LOCKS; i++)
+        if (state->locks[i].used && state->locks[i].container == c)
+            state->locks[i].used = 0;
+    for (i = 0; i < USER_MAX_OBJECTS; i++)
+        if (state->objects[i].used && state->objects[i].container == c)
+            object_destroy(i);
+    state->containers[c].used = 0;
+}
+
+/**
+ * Take thread slot t out of its container, the next thread gets the turn if t had it.
+ */
+static void thread_remove(int t)
+{
+    int c = state->threads[t].container;
+    int next = thread_next(t);
+    int i, alone = (next == t);
+
+    state->threads[t].used = 0;
+    if (state->containers[c].running == t)
+        give_turn(c, alone ? -1 : next);
+    for (i = 0; i < USER_MAX_THREADS && alone; i++)
+        if (state->threads[i].used && state->threads[i].container == c)
+            alone = 0;
+    if (alone)
+        container_destroy(c);
+}
+
+/**
+ * Remove threads whose task is gone, they would keep the turn forever.
+ */
+static void reap(void)
+{
+    int i;
+    for (i = 0; i < USER_MAX_THREADS; i++)
+        if (state->threads[i].used && kill(state->threads[i].tid, 0) != 0 && errno == ESRCH)
+            thread_remove(i);
+}
+
+/**
+ * Whether the user-space backend is in use: RCONTAINER_BACKEND=user or =kernel, or the default of the library.
+ */
+int rcontainer_user_backend(void)
+{
+    static int backend = -1;
+    const char *name;
+
+    if (backend < 0)
+    {
+        name = getenv("RCONTAINER_BACKEND");
+#ifdef RCONTAINER_BACKEND_DEFAULT_USER
+        backend = (name == NULL || strcmp(name, "kernel") != 0);
+#else
+        backend = (name != NULL && strcmp(name, "user") == 0);
+#endif
+    }
+    return backend;
+}
+
+/**
+ * A file descriptor that stands for the device, the backend itself does not use it.
+ */
+int rcontainer_user_open(void)
+{
+    if (state_attach() != 0)
+        return -1;
+    return shm_open(state_name, O_RDWR, 0600);
+}
+
+int rcontainer_user_create(int cid)
+{
+    int c, t, tid = gettid_();
+
+    if (state_attach() != 0)
+        return -1;
+    state_lock();
+    reap();
+    t = find_thread(tid);
+    if (t >= 0)
+    {
+        // the same as the kernel, a thread in another container has to migrate
+        c = state->containers[state->threads[t].container].cid != cid;
+        state_unlock();
+        if (c)
+            errno = EBUSY;
+        return c ? -1 : 0;
+    }
+    c = find_container(cid);
+    if (c < 0)
+    {
+        for (c = 0; c < USER_MAX_CONTAINERS && state->containers[c].used; c++);
+        if (c == USER_MAX_CONTAINERS)
+        {
+            state_unlock();
+            errno = ENOMEM;
+            return -1;
+        }
+        state->containers[c].used = 1;
+        state->containers[c].cid = cid;
+        state->containers[c].running = -1;
+    }
+    for (t = 0; t < USER_MAX_THREADS && state->threads[t].used; t++);
+    if (t == USER_MAX_THREADS)
+    {
+        if (state->containers[c].running < 0)
+            container_destroy(c);
+        state_unlock();
+        errno = ENOMEM;
+        return -1;
+    }
+    state->threads[t].used = 1;
+    state->threads[t].tid = tid;
+    state->threads[t].container = c;
+    state->threads[t].turn = 0;
+    state->threads[t].seq = ++state->seq;
+    if (state->containers[c].running < 0)
+        give_turn(c, t);
+    state_unlock();
+
+    wait_turn(t);
+    return 0;
+}
+
+int rcontainer_user_delete(void)
+{
+    int t;
+
+    if (state_attach() != 0)
+        return -1;
+    state_lock();
+    t = find_thread(gettid_());
+    if (t < 0)
+    {
+        state_unlock();
+        errno = EINVAL;
+        return -1;
+    }
+    thread_remove(t);
+    state_unlock();
+    return 0;
+}
+
+/**
+ * Move the turn of the next container to its next thread, then wait if the caller has lost its own turn.
+ */
+int rcontainer_user_switch(void)
+{
+    int i, c, running, t;
+
+    if (in_backend || state_attach() != 0)
+        return 0;
+    state_lock();
+    for (i = 0; i < USER_MAX_CONTAINERS; i++)
+    {
+        c = (state->switch_target + i) % USER_MAX_CONTAINERS;
+        if (!state->containers[c].used)
+            continue;
+        running = state->containers[c].running;
+        if (running >= 0 && thread_next(running) != running)
+        {
+            __atomic_store_n(&state->threads[running].turn, 0, __ATOMIC_RELEASE);
+            give_turn(c, thread_next(running));
+        }
+        state->switch_target = (c + 1) % USER_MAX_CONTAINERS;
+        break;
+    }
+    t = find_thread(gettid_());
+    state_unlock();
+
+    if (t >= 0)
+        wait_turn(t);
+    return 0;
+}
+
+/**
+ * The lock word of oid in the caller's container, created on first use. NULL with errno set on failure.
+ */
+static __u32 *lock_word(__u64 oid)
+{
+    int c, l, free_slot = -1;
+
+    if (state_attach() != 0)
+        return NULL;
+    state_lock();
+    c = current_container();
+    if (c < 0)
+    {
+        state_unlock();
+        return NULL;
+    }
+    for (l = 0; l < USER_MAX_LOCKS; l++)
+    {
+        if (state->locks[l].used && state->locks[l].container == c && state->locks[l].oid == oid)
+            break;
+        if (!state->locks[l].used && free_slot < 0)
+            free_slot = l;
+    }
+    if (l == USER_MAX_LOCKS)
+    {
+        if (free_slot < 0)
+        {
+            state_unlock();
+            errno = ENOMEM;
+            return NULL;
+        }
+        l = free_slot;
+        state->locks[l].used = 1;
+        state->locks[l].container = c;
+        state->locks[l].oid = oid;
+        state->locks[l].word = 0;
+    }
+    state_unlock();
+    return &state->locks[l].word;
+}
+
+int rcontainer_user_lock(__u64 offset)
+{
+    __u32 *word = lock_word(offset);
+    if (word == NULL)
+        return -1;
+    word_lock(word, 1);
+    return 0;
+}
+
+int rcontainer_user_unlock(__u64 offset)
+{
+    __u32 *word = lock_word(offset);
+    if (word == NULL)
+        return -1;
+    word_unlock(word);
+    return 0;
+}
+
+/**
+ * Map object oid of the caller's container, creating it with size bytes if it does not exist.
+ */
+void *rcontainer_user_heap_alloc(__u64 offset, __u64 size)
+{
+    __u64 aligned_size = ((size + getpagesize() - 1) / getpagesize()) * getpagesize();
+    char name[NAME_MAX];
+    void *address;
+    int c, o, i, fd, free_slot = -1, tid = gettid_();
+
+    if (state_attach() != 0)
+        return MAP_FAILED;
+    state_lock();
+    c = current_container();
+    if (c < 0)
+    {
+        state_unlock();
+        return MAP_FAILED;
+    }
+    for (o = 0; o < USER_MAX_OBJECTS; o++)
+    {
+        if (state->objects[o].used && state->objects[o].container == c && state->objects[o].oid == offset)
+            break;
+        if (!state->objects[o].used && free_slot < 0)
+            free_slot = o;
+    }
+    object_name(name, sizeof(name), c, offset);
+    fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0 || (o == USER_MAX_OBJECTS && (free_slot < 0 || ftruncate(fd, aligned_size) != 0)))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            shm_unlink(name);
+        }
+        state_unlock();
+        errno = (fd < 0) ? errno : ENOMEM;
+        return MAP_FAILED;
+    }
+    if (o == USER_MAX_OBJECTS)
+    {
+        o = free_slot;
+        state->objects[o].used = 1;
+        state->objects[o].container = c;
+        state->objects[o].oid = offset;
+        state->objects[o].size = aligned_size;
+        state->objects[o].nr_users = 0;
+    }
+    // record the task once, free removes it and the last one frees the object
+    for (i = 0; i < state->objects[o].nr_users && state->objects[o].users[i] != tid; i++);
+    if (i == state->objects[o].nr_users && i < USER_MAX_USERS)
+        state->objects[o].users[state->objects[o].nr_users++] = tid;
+    state_unlock();
+
+    address = mmap(0, aligned_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return address;
+}
+
+int rcontainer_user_free(__u64 offset)
+{
+    struct user_object *object;
+    int c, o, i, tid = gettid_();
+
+    if (state_attach() != 0)
+        return -1;
+    state_lock();
+    c = current_container();
+    for (o = 0; c >= 0 && o < USER_MAX_OBJECTS; o++)
+        if (state->objects[o].used && state->objects[o].container == c && state->objects[o].oid == offset)
+            break;
+    if (c < 0 || o == USER_MAX_OBJECTS)
+    {
+        state_unlock();
+        errno = EINVAL;
+        return -1;
+    }
+    object = &state->objects[o];
+    for (i = 0; i < object->nr_users && object->users[i] != tid; i++);
+    if (i == object->nr_users && object->nr_users != 0)
+    {
+        state_unlock();
+        errno = EINVAL;
+        return -1;
+    }
+    if (i < object->nr_users)
+        object->users[i] = object->users[--object->nr_users];
+    if (object->nr_users == 0)
+        object_destroy(o);
+    state_unlock();
+    return 0;
+}
+
+/**
+ * Number of threads of container cid, -1 with errno ENOENT if it does not exist.
+ */
+int rcontainer_user_nr_threads(int cid)
+{
+    int c, i, n = 0;
+
+    if (state_attach() != 0)
+        return -1;
+    state_lock();
+    c = find_container(cid);
+    for (i = 0; c >= 0 && i < USER_MAX_THREADS; i++)
+        if (state->threads[i].used && state->threads[i].container == c)
+            n++;
+    state_unlock();
+    if (c < 0)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    return n;
+}
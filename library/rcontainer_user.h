@@ -0,0 +1,50 @@
+//////////////////////////////////////////////////////////////////////
+//                     University of California, Riverside
+//
+//
+//
+//                             Copyright 2021
+//
+////////////////////////////////////////////////////////////////////////
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms and conditions of the GNU General Public License,
+// version 2, as published by the Free Software Foundation.
+//
+// This program is distributed in the hope it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+//
+////////////////////////////////////////////////////////////////////////
+//
+//   Description:
+//     User-space backend of the Resource Container library, internal to
+//     rcontainer.c. The core calls of rcontainer.h are forwarded here when
+//     RCONTAINER_BACKEND=user is set, or by default in librcontainer_user.
+//     Shared locks map onto its exclusive ones; the calls it has no
+//     counterpart for fail with errno ENOTTY.
+//
+////////////////////////////////////////////////////////////////////////
+
+#ifndef RCONTAINER_USER_H
+#define RCONTAINER_USER_H
+
+#include <linux/types.h>
+
+int rcontainer_user_backend(void);
+int rcontainer_user_open(void);
+int rcontainer_user_create(int cid);
+int rcontainer_user_delete(void);
+int rcontainer_user_switch(void);
+int rcontainer_user_lock(__u64 offset);
+int rcontainer_user_unlock(__u64 offset);
+void *rcontainer_user_heap_alloc(__u64 offset, __u64 size);
+int rcontainer_user_free(__u64 offset);
+int rcontainer_user_nr_threads(int cid);
+
+#endif